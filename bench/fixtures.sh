@@ -0,0 +1,114 @@
+#!/bin/sh
+# Generates the synthetic /proc and /sys trees measured by "make bench" (XFCE_HKMON_ROOT=<dir>/<fixture>):
+#   laptop     4 cores, one NVMe disk, wifi and ethernet, 4 hwmon chips
+#   server512  512 threads with per core cpufreq, 24 disks
+#   disks2000  2,000 block devices (1,000 disks and their partitions)
+#   veth5000   5,000 veth interfaces (a container host)
+#   hwmon30    30 hwmon chips, coretemp being the last one
+set -e
+
+out=${1:-bench/fixtures}
+
+# tree <name> <cores> <disks> <partitions per disk> <veths> <hwmon chips>
+tree()
+{
+    dir=$out/$1
+    rm -rf "$dir"
+    mkdir -p "$dir/proc/net" "$dir/sys/block" "$dir/sys/class/hwmon" "$dir/tmp"
+
+    awk -v cores="$2" 'BEGIN {
+        printf "cpu  %d 120 %d %d 900 0 310 0 0 0\n", cores * 5000, cores * 1500, cores * 90000
+        for (c = 0; c < cores; c++)
+            printf "cpu%d %d 1 %d %d 7 0 3 0 0 0\n", c, 3000 + (c * 37) % 4000, 1000 + (c * 11) % 900, 90000 - c % 5000
+        printf "intr 123456789"
+        for (i = 0; i < 1024; i++) printf " %d", (i * 7919) % 100000
+        printf "\nctxt 987654321\nbtime 1700000000\nprocesses 123456\nprocs_running 3\nprocs_blocked 0\n"
+    }' > "$dir/proc/stat"
+
+    awk -v cores="$2" 'BEGIN {
+        for (c = 0; c < cores; c++)
+            printf "processor\t: %d\nmodel name\t: Synthetic CPU\ncpu MHz\t\t: %d.000\ncache size\t: 32768 KB\n\n",
+                   c, 1200 + (c * 53) % 3000
+    }' > "$dir/proc/cpuinfo"
+    c=0
+    while [ "$c" -lt "$2" ]; do
+        mkdir -p "$dir/sys/devices/system/cpu/cpu$c/cpufreq"
+        echo $((1200000 + (c * 53000) % 3000000)) > "$dir/sys/devices/system/cpu/cpu$c/cpufreq/scaling_cur_freq"
+        c=$((c + 1))
+    done
+    echo "0-$(($2 - 1))" > "$dir/sys/devices/system/cpu/online"
+
+    cat > "$dir/proc/meminfo" <<EOF
+MemTotal:       $(($2 * 4194304)) kB
+MemFree:        $(($2 * 1048576)) kB
+MemAvailable:   $(($2 * 2097152)) kB
+Buffers:          262144 kB
+Cached:         $(($2 * 524288)) kB
+SwapCached:            0 kB
+Active:          4194304 kB
+Inactive:        2097152 kB
+SwapTotal:       8388608 kB
+SwapFree:        8000000 kB
+Dirty:              1024 kB
+Shmem:            131072 kB
+Slab:             524288 kB
+EOF
+
+    awk -v disks="$3" -v parts="$4" -v dir="$dir" 'BEGIN {
+        print "major minor  #blocks  name\n" > (dir "/proc/partitions")
+        for (d = 0; d < disks; d++)
+        {
+            name = "nvme" d "n1"
+            printf "%4d %7d %s %d 10 %d 300 %d 20 %d 900 0 %d %d 0 0 0 0 40 60\n", 259, d * 16, name,
+                   5000 + d, 800000 + d, 3000 + d, 900000 + d, 700, 1300 > (dir "/proc/diskstats")
+            printf "%4d %7d %10d %s\n", 259, d * 16, 1953125000, name > (dir "/proc/partitions")
+            system("mkdir -p " dir "/sys/block/" name)
+            printf "%.0f\n", 3906250000 > (dir "/sys/block/" name "/size")
+            close(dir "/sys/block/" name "/size")
+            for (p = 1; p <= parts; p++)
+            {
+                printf "%4d %7d %sp%d %d 0 %d 100 %d 0 %d 200 0 %d %d 0 0 0 0 0 0\n", 259, d * 16 + p, name, p,
+                       100 + p, 8000 + p, 50 + p, 4000 + p, 250, 300 > (dir "/proc/diskstats")
+                printf "%4d %7d %10d %sp%d\n", 259, d * 16 + p, 976562500, name, p > (dir "/proc/partitions")
+            }
+        }
+    }'
+
+    awk -v veths="$5" 'BEGIN {
+        print "Inter-|   Receive                                                |  Transmit"
+        print " face |bytes    packets errs drop fifo frame compressed multicast|" \
+              "bytes    packets errs drop fifo colls carrier compressed"
+        printf "%6s: %d %d 0 0 0 0 0 0 %d %d 0 0 0 0 0 0\n", "lo", 67334926, 7672, 67334926, 7672
+        printf "%6s: %d %d 0 3 0 0 0 120 %d %d 0 0 0 0 0 0\n", "eth0", 987654321, 812345, 123456789, 412345
+        printf "%6s: %d %d 0 0 0 0 0 0 %d %d 0 0 0 0 0 0\n", "wlan0", 55443322, 44332, 11223344, 22334
+        for (v = 0; v < veths; v++)
+            printf "%6s: %d %d 0 0 0 0 0 0 %d %d 0 0 0 0 0 0\n", "veth" v, 1000 * v, v, 2000 * v, 2 * v
+    }' > "$dir/proc/net/dev"
+
+    h=0
+    while [ "$h" -lt "$6" ]; do
+        chip=$dir/sys/class/hwmon/hwmon$h
+        mkdir -p "$chip"
+        if [ "$h" -eq $(($6 - 1)) ]; then
+            echo coretemp > "$chip/name"
+            echo "Package id 0" > "$chip/temp1_label"
+            echo 52000 > "$chip/temp1_input"
+            i=2
+            while [ "$i" -le 9 ]; do
+                echo "Core $((i - 2))" > "$chip/temp${i}_label"
+                echo $((45000 + i * 1000)) > "$chip/temp${i}_input"
+                i=$((i + 1))
+            done
+        else
+            echo "acpitz$h" > "$chip/name"
+            echo 40000 > "$chip/temp1_input"
+        fi
+        h=$((h + 1))
+    done
+}
+
+tree laptop 4 1 3 0 4
+tree server512 512 24 1 0 6
+tree disks2000 8 1000 1 0 4
+tree veth5000 8 2 1 5000 4
+tree hwmon30 8 2 1 0 30
@@ -17,31 +17,64 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
  */
 
-// g++ -std=c++0x -O3 -lrt xfce-hkmon.cpp -o xfce-hkmon (gcc >= 4.6 or clang++)
+// g++ -std=c++0x -O3 -pthread -lrt xfce-hkmon.cpp -o xfce-hkmon (gcc >= 4.7 or clang++)
 // Recommended 1 second period and "Bitstream Vera Sans Mono" font on the applet
 
 #include <cstdlib>
+#include <cstdio>
 #include <memory>
-#include <iostream>
-#include <iomanip>
 #include <cstring>
 #include <cerrno>
 #include <cstdint>
-#include <sstream>
 #include <limits>
+#include <type_traits>
 #include <string>
 #include <cctype>
 #include <cmath>
 #include <ctime>
 #include <vector>
 #include <map>
+#include <algorithm>
+#include <functional>
+#include <cstddef>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <chrono>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/file.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/if_link.h>
+#include <fnmatch.h>
+#include <dirent.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#define HKMON_URING
+#ifdef IORING_FILE_INDEX_ALLOC
+#define HKMON_URING_OPENAT // opens into fixed file slots (sqe file_index)
+#endif
+#endif
+#endif
+#include <csignal>
 
 #define APP_VERSION "2.1"
 
-#define VA_STR(x) dynamic_cast<std::ostringstream const&>(std::ostringstream().flush() << x).str()
+#define STATE_MAGIC "HKMONST\0"
+#define STATE_VERSION 18
+
+#define RECORD_MAGIC "HKMONREC"
 
 auto constexpr MB_i = 1000000LL;
 auto constexpr MB_f = 1000000.0;
@@ -50,16 +83,235 @@ auto constexpr GB_f = 1000000000.0;
 auto constexpr TB_i = 1000000000000LL;
 auto constexpr TB_f = 1000000000000.0; // only C++14 has a readable alternative
 
+struct Fixed { double value; int decimals; }; // like printf("%.*f") (the C locale is never changed)
+struct Hex { uint64_t value; };
+
+class Output // text rendered into a preallocated buffer: no streams (nor their locale), a single write(2) at the end
+{
+public:
+    explicit Output(std::size_t capacity = 4096) { text.reserve(capacity); }
+
+    Output& width(std::size_t columns) { pending = columns; return *this; } // right aligns the next item (std::setw)
+    Output& spaces(std::size_t count) { text.append(count, ' '); return *this; }
+
+    Output& operator<<(const char* data) { return append(data, strlen(data)); }
+    Output& operator<<(const std::string& data) { return append(data.data(), data.length()); }
+    Output& operator<<(char c) { return append(&c, 1); }
+
+    template <typename T> typename std::enable_if<std::is_integral<T>::value, Output&>::type operator<<(T value)
+    {
+        bool negative = std::is_signed<T>::value && (int64_t(value) < 0);
+        return integer(negative? 0 - uint64_t(int64_t(value)) : uint64_t(value), negative);
+    }
+
+    Output& operator<<(const Hex& number)
+    {
+        char digits[16], *start = digits + sizeof(digits);
+        uint64_t value = number.value;
+        do *--start = "0123456789abcdef"[value % 16]; while (value /= 16);
+        return append(start, digits + sizeof(digits) - start);
+    }
+
+    Output& operator<<(const Fixed& number)
+    {
+        static const double scales[] = { 1, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6 };
+        double magnitude = std::fabs(number.value);
+        if (std::isnan(magnitude) || (magnitude >= 1e12) || (number.decimals < 0) || (number.decimals > 6))
+        {
+            char formatted[32]; // out of the fast path range (or "nan", "inf")
+            int length = snprintf(formatted, sizeof(formatted), "%.*f", number.decimals, number.value);
+            return append(formatted, std::min<std::size_t>(std::max(length, 0), sizeof(formatted) - 1));
+        }
+        uint64_t units = uint64_t(std::nearbyint(magnitude * scales[number.decimals])); // ties to even
+        char digits[32], *start = digits + sizeof(digits);
+        for (int decimal = 0; decimal < number.decimals; decimal++, units /= 10) *--start = char('0' + units % 10);
+        if (number.decimals) *--start = '.';
+        do *--start = char('0' + units % 10); while (units /= 10);
+        if (std::signbit(number.value)) *--start = '-';
+        return append(start, digits + sizeof(digits) - start);
+    }
+
+    bool empty() const { return text.empty(); }
+    void chopNewline() { if (!text.empty() && (text.back() == '\n')) text.erase(text.end()-1); }
+    const std::string& str() const { return text; }
+
+    bool writeTo(int fd) const { return writeFully(fd, text); }
+
+    static bool writeFully(int fd, const std::string& data)
+    {
+        for (std::size_t offset = 0; offset < data.length();)
+        {
+            ssize_t bytes = write(fd, data.data() + offset, data.length() - offset);
+            if ((bytes < 0) && (errno == EINTR)) continue;
+            if (bytes <= 0) return false;
+            offset += bytes;
+        }
+        return true;
+    }
+
+private:
+    Output& integer(uint64_t magnitude, bool negative)
+    {
+        char digits[24], *start = digits + sizeof(digits);
+        do *--start = char('0' + magnitude % 10); while (magnitude /= 10);
+        if (negative) *--start = '-';
+        return append(start, digits + sizeof(digits) - start);
+    }
+
+    Output& append(const char* data, std::size_t length)
+    {
+        if (pending > length) text.append(pending - length, ' ');
+        pending = 0;
+        text.append(data, length);
+        return *this;
+    }
+
+    std::string text;
+    std::size_t pending = 0;
+};
+
 void abortApp(const char* reason)
 {
-    std::cout << "<txt>ERROR " << errno << ":\n" << (reason? reason : "") << "</txt>"
-              << "<tool>" << strerror(errno) << "</tool>";
+    int error = errno;
+    Output message(256);
+    message << "<txt>ERROR " << error << ":\n" << (reason? reason : "") << "</txt>"
+            << "<tool>" << strerror(error) << "</tool>";
+    message.writeTo(STDOUT_FILENO);
     exit(2);
 }
 
+#ifdef HKMON_COUNT_ALLOCATIONS // only in the "make bench" build: global new is replaced to count them for BENCH
+std::atomic<uint64_t> heapAllocations(0);
+
+void* __attribute__((noinline)) operator new(std::size_t size) // neither inlined: avoids bogus gcc warnings
+{
+    heapAllocations.fetch_add(1, std::memory_order_relaxed);
+    void* block = malloc(size? size : 1);
+    if (!block) throw std::bad_alloc();
+    return block;
+}
+
+void __attribute__((noinline)) operator delete(void* block) noexcept
+{
+    free(block);
+}
+#else
+const uint64_t heapAllocations = 0;
+#endif
+
+uint64_t monotonicNsecs(clockid_t clock = CLOCK_MONOTONIC)
+{
+    timespec tp;
+    if (clock_gettime(clock, &tp) != 0) abortApp("clock_gettime");
+    return tp.tv_sec * GB_i + tp.tv_nsec;
+}
+
+struct Timings // cost of each phase of the ticks
+{
+    enum Phase
+    {
+        BATCH_READ, CPU_READ, MEMORY_READ, IO_READ, NETWORK_READ, HEALTH_READ, PROCESSES_READ, PRESSURE_READ,
+        NUMA_READ, THROTTLE_READ, STATE_LOAD, STATE_STORE, REPORT, PHASES
+    };
+
+    static const char* name(int phase)
+    {
+        static const char* names[PHASES] = { "batch read", "CPU", "Memory", "IO", "Network", "Health", "Processes",
+                                             "Pressure", "NUMA", "Throttling", "state load", "state store",
+                                             "report" };
+        return names[phase];
+    }
+
+    uint64_t nsecs[PHASES];
+    uint64_t cpuNsecs[PHASES];
+    uint64_t allocations[PHASES];
+    uint64_t opens;                             // syscalls issued by readFile() (under filesLock)
+    uint64_t reads;
+    std::map<std::string, uint64_t> bytesRead; // by source file
+};
+
+Timings* timings = nullptr; // phases are only measured while set
+
+class Probe // adds the cost of its own scope to the active timings
+{
+public:
+    Probe(Timings::Phase phase)
+        : phase(phase), startNsecs(timings? monotonicNsecs() : 0),
+          startCpuNsecs(timings? monotonicNsecs(CLOCK_THREAD_CPUTIME_ID) : 0), startAllocations(heapAllocations) {}
+
+    ~Probe()
+    {
+        if (!timings) return;
+        timings->nsecs[phase] += monotonicNsecs() - startNsecs;
+        timings->cpuNsecs[phase] += monotonicNsecs(CLOCK_THREAD_CPUTIME_ID) - startCpuNsecs;
+        timings->allocations[phase] += heapAllocations - startAllocations;
+    }
+
+private:
+    Timings::Phase phase;
+    uint64_t startNsecs;
+    uint64_t startCpuNsecs;
+    uint64_t startAllocations;
+};
+
+std::string sourceRoot; // prefixed to every /proc, /sys and runtime path (XFCE_HKMON_ROOT, for fixtures)
+
+std::string rooted(const std::string& path) { return sourceRoot + path; }
+
+std::map<std::string, int> persistentFiles; // kept open by the daemon and re-read at offset 0 on every sample
+bool keepFilesOpen = false;
+std::size_t persistentCapacity = 0; // below RLIMIT_NOFILE, leaving room for the transient descriptors
+
+void keepFiles() // the daemon, exporter and recorder: the per core sysfs files of big hosts exceed the soft limit
+{
+    rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) != 0) return;
+    rlimit raised = limit;
+    raised.rlim_cur = std::max(limit.rlim_cur, std::min<rlim_t>(limit.rlim_max, 65536));
+    if ((raised.rlim_cur != limit.rlim_cur) && (setrlimit(RLIMIT_NOFILE, &raised) == 0)) limit = raised;
+    persistentCapacity = limit.rlim_cur > 256? limit.rlim_cur - 128 : limit.rlim_cur / 2;
+    keepFilesOpen = true;
+}
+
+bool persistable() // (under filesLock) beyond the capacity the files are opened on each read instead
+{
+    return keepFilesOpen && (persistentFiles.size() < persistentCapacity);
+}
+std::mutex filesLock; // persistentFiles and the readFile() timings (PARALLEL collectors)
+std::map<std::string, std::vector<char>> prefetched; // contents read ahead by the URING batch (under filesLock)
+struct FileRead { std::string path; uint32_t length; }; // the length sizes the buffer of the next batched read
+std::vector<FileRead> filesRead; // this tick's readFile() successes, batched in the next one (under filesLock)
+bool batchReads = false;
+
 bool readFile(const char* inputFile, std::vector<char>& buffer, bool mustExist = true)
 {
-    int fd = open(inputFile, O_RDONLY);
+    if (batchReads)
+    {
+        std::lock_guard<std::mutex> lock(filesLock);
+        auto itp = prefetched.find(inputFile);
+        if (itp != prefetched.end())
+        {
+            buffer.swap(itp->second);
+            prefetched.erase(itp);
+            filesRead.push_back(FileRead { inputFile, uint32_t(buffer.size()) });
+            return true;
+        }
+    }
+    int fd = -1;
+    bool cached = false, persistent = false;
+    if (keepFilesOpen)
+    {
+        std::lock_guard<std::mutex> lock(filesLock);
+        auto itf = persistentFiles.find(inputFile);
+        if ((cached = persistent = (itf != persistentFiles.end()))) fd = itf->second;
+    }
+    if (!cached)
+    {
+        fd = open(sourceRoot.empty()? inputFile : rooted(inputFile).c_str(), O_RDONLY | O_CLOEXEC);
+        std::lock_guard<std::mutex> lock(filesLock);
+        if (timings) timings->opens++;
+        if ((persistent = (fd >= 0) && persistable())) persistentFiles[inputFile] = fd; // (not shared by collectors)
+    }
     if (fd < 0)
     {
         if (mustExist) abortApp(inputFile);
@@ -68,15 +320,30 @@ bool readFile(const char* inputFile, std::vector<char>& buffer, bool mustExist =
     else
     {
         buffer.resize(4000);
-        for (std::size_t offset = 0;;)
+        for (std::size_t offset = 0, reads = 1;; reads++)
         {
-            int bytes = ::read(fd, &buffer[offset], buffer.size() - offset - 1);
+            int bytes = ::pread(fd, &buffer[offset], buffer.size() - offset - 1, offset);
+            if ((bytes < 0) && cached) // device gone (e.g. hwmon reload)
+            {
+                close(fd);
+                {
+                    std::lock_guard<std::mutex> lock(filesLock);
+                    persistentFiles.erase(inputFile);
+                }
+                return readFile(inputFile, buffer, mustExist);
+            }
             if (bytes < 0) abortApp(inputFile);
             offset += bytes;
             if (offset + 1 == buffer.size()) buffer.resize(buffer.size() * 2);
             else if (bytes == 0)
             {
-                close(fd);
+                if (!persistent) close(fd);
+                if (timings || batchReads)
+                {
+                    std::lock_guard<std::mutex> lock(filesLock);
+                    if (batchReads) filesRead.push_back(FileRead { inputFile, uint32_t(offset) });
+                    if (timings) timings->reads += reads, timings->bytesRead[inputFile] += offset;
+                }
                 buffer[offset] = 0;
                 buffer.resize(offset);
                 return true;
@@ -85,515 +352,2635 @@ bool readFile(const char* inputFile, std::vector<char>& buffer, bool mustExist =
     }
 }
 
-bool writeFile(const char* outputFile, const std::ostringstream& data)
+#ifdef HKMON_URING
+
+class Uring // just enough io_uring for batches of reads (raw syscalls: liburing is not required)
 {
-    bool success = false;
-    int fd = open(outputFile, O_CREAT | O_WRONLY | O_TRUNC, 0640);
-    if (fd >= 0)
+public:
+    struct Read
     {
-        const std::string& buffer = data.str();
-        if (write(fd, buffer.c_str(), buffer.length()) == (ssize_t) buffer.length()) success = true;
-        close(fd);
-    }
-    return success;
-}
+        int fd;          // or index in the registered files
+        bool fixed;
+        char* data;
+        unsigned length;
+        bool closeAfter; // by a hard linked request
+        int result;      // bytes read or -errno
+        bool closed;
+        const char* path; // opened by a linked request into the fixed file slot fd (nullptr: fd is already open)
+        int opened;       // its result
+    };
 
-template <typename K, typename V> std::ostream& operator<<(std::ostream& out, const std::map<K,V>& container)
-{
-    for (const auto& item : container) out << item.first << '|' << item.second << '\t'; // write into storage
-    return out << '\n';
-}
+    ~Uring()
+    {
+        if (ringFd < 0) return;
+        munmap(sqes, sqesSize);
+        if (cqRing != sqRing) munmap(cqRing, cqSize);
+        munmap(sqRing, sqSize);
+        close(ringFd);
+    }
 
-template <typename T> bool fromString(const std::string& from, T& to) { return bool(std::istringstream(from) >> to); }
+    bool setup(unsigned entries)
+    {
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        ringFd = int(syscall(__NR_io_uring_setup, entries, &params));
+        if (ringFd < 0) return false; // kernel < 5.1 or disabled
+        sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+        bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single) sqSize = cqSize = std::max(sqSize, cqSize);
+        auto map = [&](std::size_t size, off_t offset) -> char*
+        {
+            void* area = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, offset);
+            return area == MAP_FAILED? nullptr : static_cast<char*>(area);
+        };
+        sqRing = map(sqSize, IORING_OFF_SQ_RING);
+        cqRing = single? sqRing : map(cqSize, IORING_OFF_CQ_RING);
+        sqes = reinterpret_cast<io_uring_sqe*>(map(sqesSize, IORING_OFF_SQES));
+        if (!sqRing || !cqRing || !sqes) abortApp("io_uring mmap");
+        sqTail = reinterpret_cast<unsigned*>(sqRing + params.sq_off.tail);
+        sqMask = *reinterpret_cast<unsigned*>(sqRing + params.sq_off.ring_mask);
+        sqArray = reinterpret_cast<unsigned*>(sqRing + params.sq_off.array);
+        cqHead = reinterpret_cast<unsigned*>(cqRing + params.cq_off.head);
+        cqTail = reinterpret_cast<unsigned*>(cqRing + params.cq_off.tail);
+        cqMask = *reinterpret_cast<unsigned*>(cqRing + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe*>(cqRing + params.cq_off.cqes);
+        capacity = params.sq_entries;
+        return true;
+    }
 
-template <> bool fromString(const std::string& from, std::string& to) { to = from; return true; }
+    bool registerFiles(const std::vector<int>& fds) // replaces the previous table
+    {
+        if (registered) syscall(__NR_io_uring_register, ringFd, IORING_UNREGISTER_FILES, nullptr, 0);
+        registered = !fds.empty()
+                     && !syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_FILES, fds.data(), fds.size());
+        return registered;
+    }
 
-template <typename K, typename V> std::istream& operator>>(std::istream& in, std::map<K,V>& container)
-{
-    while (!in.eof() && !in.fail() && (in.peek() != '\n')) // read from storage
+    int submit(std::vector<Read>& reads) // io_uring_enter() calls issued (-1: the ring is unusable)
     {
-        std::string skey;
-        if (std::getline(in, skey, '|'))
+        int calls = 0;
+        for (std::size_t first = 0, last = 0; first < reads.size(); first = last)
         {
-            K key;
-            V value;
-            if (fromString(skey, key) && (in >> value))
+            unsigned tail = *sqTail, queued = 0;
+            for (; (last < reads.size()) && (queued + 1 + reads[last].closeAfter + !!reads[last].path <= capacity);
+                 last++)
+            {
+                Read& read = reads[last];
+                read.result = read.opened = -ECANCELED;
+                read.closed = false;
+#ifdef HKMON_URING_OPENAT
+                if (read.path) // (the read and close are cancelled if it fails)
+                {
+                    io_uring_sqe* sqe = queue(tail, queued, IORING_OP_OPENAT, AT_FDCWD, 4*last + 2);
+                    sqe->addr = reinterpret_cast<uint64_t>(read.path);
+                    sqe->open_flags = O_RDONLY; // (O_CLOEXEC is refused for fixed files, never inherited anyway)
+                    sqe->file_index = read.fd + 1;
+                    sqe->flags |= IOSQE_IO_LINK;
+                }
+#endif
+                io_uring_sqe* sqe = queue(tail, queued, IORING_OP_READ, read.fd, 4*last);
+                sqe->addr = reinterpret_cast<uint64_t>(read.data);
+                sqe->len = read.length;
+                if (read.fixed) sqe->flags |= IOSQE_FIXED_FILE;
+                if (!read.closeAfter) continue;
+                sqe->flags |= IOSQE_IO_HARDLINK; // short reads would cancel a plain link
+                sqe = queue(tail, queued, IORING_OP_CLOSE, read.path? 0 : read.fd, 4*last + 1);
+#ifdef HKMON_URING_OPENAT
+                if (read.path) sqe->file_index = read.fd + 1;
+#endif
+            }
+            __atomic_store_n(sqTail, tail, __ATOMIC_RELEASE);
+            for (unsigned unsubmitted = queued, pending = queued; pending;)
             {
-                container.insert( { key, value } );
-                in.ignore(); // tab
+                int done = int(syscall(__NR_io_uring_enter, ringFd, unsubmitted, pending, IORING_ENTER_GETEVENTS,
+                                       nullptr, 0));
+                calls++;
+                if ((done < 0) && (errno == EINTR)) continue;
+                if (done < 0) return -1;
+                unsubmitted -= std::min(unsubmitted, unsigned(done));
+                unsigned head = *cqHead;
+                for (unsigned ready = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE); head != ready; head++, pending--)
+                {
+                    const io_uring_cqe& cqe = cqes[head & cqMask];
+                    Read& read = reads[cqe.user_data / 4];
+                    if (cqe.user_data % 4 == 0) read.result = cqe.res;
+                    else if (cqe.user_data % 4 == 2) read.opened = cqe.res;
+                    else read.closed = (cqe.res >= 0) || read.path || !close(read.fd); // IORING_OP_CLOSE: kernel 5.6
+                }
+                __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
             }
         }
+        return calls;
+    }
+
+private:
+    io_uring_sqe* queue(unsigned& tail, unsigned& queued, uint8_t opcode, int fd, uint64_t userData)
+    {
+        unsigned index = tail++ & sqMask;
+        io_uring_sqe* sqe = &sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = opcode;
+        sqe->fd = fd;
+        sqe->user_data = userData;
+        sqArray[index] = index;
+        queued++;
+        return sqe;
     }
-    return in.ignore();
-}
 
-struct CPU
+    int ringFd = -1;
+    bool registered = false;
+    unsigned capacity = 0;
+    std::size_t sqSize = 0, cqSize = 0, sqesSize = 0;
+    char* sqRing = nullptr;
+    char* cqRing = nullptr;
+    io_uring_sqe* sqes = nullptr;
+    io_uring_cqe* cqes = nullptr;
+    unsigned *sqTail = nullptr, *sqArray = nullptr, *cqHead = nullptr, *cqTail = nullptr;
+    unsigned sqMask = 0, cqMask = 0;
+};
+
+void readAhead(const std::vector<FileRead>& files) // the files of the previous tick in one io_uring batch
 {
-    typedef int16_t Number; // -1 for all cores summary and 0,1,2,... for each core
+    static Uring ring;
+    static bool usable = ring.setup(128);
+    static std::vector<int> registered;
+    static std::size_t slots = 0; // registered empty, for the files the ring opens
+#ifdef HKMON_URING_OPENAT
+    static bool ringOpens = true; // kernel 5.15+: standalone ticks open the files in the batch too, no open() calls
+#else
+    static bool ringOpens = false;
+#endif
+    std::unique_lock<std::mutex> lock(filesLock);
+    prefetched.clear();
+    if (!usable) return;
 
-    struct Core
+    bool opening = ringOpens && !keepFilesOpen && !files.empty(); // (the daemon keeps them open instead)
+    if (opening && (files.size() > slots))
     {
-        int64_t user, nice, system, idle, iowait, irq, softirq, steal, guest, guestnice;
-        uint64_t freq_hz;
-        int64_t cpuUsed()  const { return user + nice + system + irq + softirq + guest + guestnice; }
-        int64_t cpuTotal() const { return cpuUsed() + idle + iowait + steal; }
-        Core operator-(const Core& that) const
+        slots = std::max(files.size(), 2 * slots);
+        registered.clear();
+        if (!(ringOpens = opening = ring.registerFiles(std::vector<int>(slots, -1)))) slots = 0;
+    }
+    std::vector<Uring::Read> reads;
+    std::vector<int> fds;
+    std::vector<const std::string*> names;
+    std::vector<std::string> paths;
+    paths.reserve(files.size()); // (their c_str() are queued)
+    bool allPersistent = keepFilesOpen;
+    for (const auto& file : files)
+    {
+        if (opening)
         {
-            int64_t roundUserFix = user == that.user-1? 1 : 0; // compensate for physical host & virtual
-            int64_t roundNiceFix = nice == that.nice-1? 1 : 0; // guests counters evil rounding
-            return
-            {
-                user - that.user + roundUserFix, nice - that.nice + roundNiceFix, system - that.system,
-                idle - that.idle, iowait - that.iowait, irq - that.irq, softirq - that.softirq,
-                steal - that.steal, guest - that.guest + roundUserFix, guestnice - that.guestnice + roundNiceFix,
-                (freq_hz + that.freq_hz) / 2 // <-- a more useful abstraction
-            };
+            paths.push_back(rooted(file.path));
+            std::vector<char>& data = prefetched[file.path];
+            data.resize(file.length + file.length / 8 + 256);
+            reads.push_back(Uring::Read { int(reads.size()), true, data.data(), unsigned(data.size() - 1), true, 0,
+                                          false, paths.back().c_str(), 0 });
+            fds.push_back(-1);
+            names.push_back(&file.path);
+            continue;
         }
-    };
-
-    std::map<Number, Core> cores;
+        int fd = -1;
+        bool persistent = true;
+        auto itf = keepFilesOpen? persistentFiles.find(file.path) : persistentFiles.end();
+        if (itf != persistentFiles.end()) fd = itf->second;
+        else
+        {
+            fd = open(rooted(file.path).c_str(), O_RDONLY | O_CLOEXEC);
+            if (timings) timings->opens++;
+            if (fd < 0) continue;
+            if ((persistent = persistable())) persistentFiles[file.path] = fd;
+            else allPersistent = false;
+        }
+        std::vector<char>& data = prefetched[file.path];
+        data.resize(file.length + file.length / 8 + 256); // (room to grow, and for the end of file detection)
+        reads.push_back(Uring::Read { fd, false, data.data(), unsigned(data.size() - 1), !persistent, 0, false,
+                                      nullptr, 0 });
+        fds.push_back(fd);
+        names.push_back(&file.path);
+    }
+    if (allPersistent && ((fds == registered) || ring.registerFiles(fds))) // the daemon reads the same files
+    {
+        registered = fds;
+        slots = 0;
+        for (std::size_t ir = 0; ir < reads.size(); ir++) reads[ir].fd = int(ir), reads[ir].fixed = true;
+    }
 
-    void readProc()
+    std::vector<std::size_t> batch(reads.size()); // of reads, then the ones that filled their buffer
+    for (std::size_t ir = 0; ir < reads.size(); ir++) batch[ir] = ir;
+    while (usable && !batch.empty())
     {
-        std::vector<char> buffer;
-        readFile("/proc/stat", buffer);
-        std::istringstream cpustat(&buffer[0]);
-        std::string name;
-        Number number;
-        while (cpustat >> name)
-        {
-            if (name.find("cpu") == 0)
-            {
-                name.erase(0,3);
-                if (name.empty()) number = -1; else if (!fromString(name, number)) continue;
-                Core& core = cores[number];
-                cpustat >> core.user >> core.nice >> core.system >> core.idle
-                        >> core.iowait >> core.irq >> core.softirq;
-                if (cpustat.peek() != '\n') cpustat >> core.steal; else core.steal = 0; // caution with old kernels
-                if (cpustat.peek() != '\n') cpustat >> core.guest; else core.guest = 0;
-                if (cpustat.peek() != '\n') cpustat >> core.guestnice; else core.guestnice = 0;
-                core.freq_hz = 0;
-                core.user -= core.guest;     // adjust for the already accounted values (may cause evil rounding
-                core.nice -= core.guestnice; // effects, though)
-            }
-            cpustat.ignore(buffer.size(), '\n');
+        std::vector<Uring::Read> submitted;
+        for (std::size_t ir : batch) submitted.push_back(reads[ir]);
+        int calls = ring.submit(submitted);
+        if (calls < 0) usable = false; // everything is read again by the blocking readFile()
+        else if (timings) timings->reads += calls;
+        if (opening && std::any_of(submitted.begin(), submitted.end(),
+                                   [](const Uring::Read& read) { return read.opened == -EINVAL; })) // older kernel
+        {
+            ringOpens = false;
+            lock.unlock();
+            return readAhead(files); // with open() calls
         }
-        readFile("/proc/cpuinfo", buffer);
-        std::istringstream cpuinfo(&buffer[0]);
-        std::string key;
-        std::string skip;
-        uint64_t sum_freq = 0;
-        number = -1;
-        while (cpuinfo >> key)
+        std::vector<std::size_t> grown;
+        for (std::size_t ib = 0; ib < batch.size(); ib++)
         {
-            if (key == "processor") cpuinfo >> skip >> number;
-            else if ((key == "cpu") && (number >= 0))
+            std::size_t ir = batch[ib];
+            Uring::Read& read = reads[ir] = submitted[ib];
+            if (read.closeAfter && !read.closed && (fds[ir] >= 0)) close(fds[ir]);
+            auto itp = prefetched.find(*names[ir]);
+            if ((calls < 0) || (read.result < 0)) // errors
+            {
+                prefetched.erase(itp);
+                continue;
+            }
+            if (unsigned(read.result) >= read.length) // bigger than the buffer: grown and read again
             {
-                if ((cpuinfo >> skip) && (skip == "MHz"))
+                if (read.closeAfter && !read.path // (else opened again by the ring)
+                    && ((fds[ir] = open(rooted(*names[ir]).c_str(), O_RDONLY | O_CLOEXEC)) < 0))
                 {
-                    double mhz;
-                    cpuinfo >> skip >> mhz;
-                    cores[number].freq_hz = uint64_t(mhz * MB_i);
-                    sum_freq += cores[number].freq_hz;
-                    number = -1;
+                    prefetched.erase(itp);
+                    continue;
                 }
+                if (read.closeAfter && !read.path) read.fd = fds[ir];
+                if (timings && read.closeAfter && !read.path) timings->opens++;
+                itp->second.resize(itp->second.size() * 2);
+                read.data = itp->second.data();
+                read.length = unsigned(itp->second.size() - 1);
+                grown.push_back(ir);
+                continue;
             }
-            cpuinfo.ignore(buffer.size(), '\n');
+            itp->second[read.result] = 0;
+            itp->second.resize(read.result);
+            if (timings) timings->bytesRead[*names[ir]] += read.result;
         }
-        auto allcpu = cores.find(-1);
-        if (allcpu != cores.end()) allcpu->second.freq_hz = sum_freq;
+        batch.swap(grown);
     }
+}
+
+#else
+
+void readAhead(const std::vector<FileRead>&) {} // no io_uring headers: always the blocking readFile()
+
+#endif
+
+// The state file holds the previous sample in a fixed binary layout (native endianness, it never leaves the host):
+// a StateHeader, the StateSection table and the packed record arrays. It is mmap'ed and updated in place under a
+// sequence counter, so lock-free readers retry instead of seeing a half-written sample (writers still use flock).
+
+enum class StateId : uint32_t
+{
+    CPU = 1, CPUJiffies, CPUFreq, CPUOnline, IO, Network, HealthSource, HealthLabels, Latency,
+    HistorySeries, HistoryDeltas, IOBlocks, IOScan, SampledAt, ReadSet, Memory, HealthTemps, Processes,
+    Pressure, CPUThrottling, NumaCores, NumaNodes, NumaScan, ThrottleCores, ThrottleScan, ReadSetOwners,
+    HistoryRetention
 };
 
-std::ostream& operator<<(std::ostream& out, const CPU::Core& core) // write into storage
+// The categories keep the stored sample and the one before it (the applet instances sharing the file reuse both),
+// a pair for each variant (collection options) in use: instances with other options never compare against it
+const uint32_t PREVIOUS_SLOT = 0x100;  // added to the section ids of the older one
+const uint32_t VARIANT_SLOTS = 4;      // pairs kept per category (the least recently sampled one is dropped)
+const uint32_t VARIANT_STRIDE = 0x200; // between the section ids of consecutive pairs
+
+uint32_t slotOf(uint32_t pair, bool previous) { return pair * VARIANT_STRIDE + (previous? PREVIOUS_SLOT : 0); }
+
+StateId categoryOf(StateId id) // the one (as in SampledAt) a section of any slot belongs to, else 0
 {
-    return out << core.user << ' ' << core.nice << ' ' << core.system << ' ' << core.idle << ' '
-               << core.iowait << ' ' << core.irq << ' ' << core.softirq << ' '
-               << core.steal << ' ' << core.guest << ' ' << core.guestnice << ' ' << core.freq_hz;
+    switch (StateId(uint32_t(id) % VARIANT_STRIDE % PREVIOUS_SLOT))
+    {
+        case StateId::CPU: case StateId::CPUJiffies: case StateId::CPUFreq: case StateId::CPUOnline:
+        case StateId::CPUThrottling: return StateId::CPU;
+        case StateId::Memory: return StateId::Memory;
+        case StateId::IO: case StateId::IOBlocks: case StateId::IOScan: return StateId::IO;
+        case StateId::Network: return StateId::Network;
+        case StateId::HealthSource: case StateId::HealthLabels: case StateId::HealthTemps: return StateId::HealthSource;
+        case StateId::Processes: return StateId::Processes;
+        case StateId::Pressure: return StateId::Pressure;
+        case StateId::NumaCores: case StateId::NumaNodes: case StateId::NumaScan: return StateId::NumaNodes;
+        case StateId::ThrottleCores: case StateId::ThrottleScan: return StateId::ThrottleCores;
+        default: return StateId(0);
+    }
 }
 
-std::istream& operator>>(std::istream& in, CPU::Core& core) // read from storage
+StateId operator+(StateId id, uint32_t slot) { return StateId(uint32_t(id) + slot); }
+
+struct Sampled // when, and with which collection options, a category sample was taken
 {
-    return in >> core.user >> core.nice >> core.system >> core.idle >> core.iowait >> core.irq
-              >> core.softirq >> core.steal >> core.guest >> core.guestnice >> core.freq_hz;
-}
+    uint64_t nowIs = 0;
+    uint64_t variant = 0; // hash of the options: only instances with the same ones can share the sample
+};
 
-struct Memory
+struct StateHeader
 {
-    struct RAM
-    {
-        uint64_t total;
-        uint64_t available;
-        uint64_t free;
-        uint64_t shared;
-        uint64_t buffers;
-        uint64_t cached;
-        uint64_t swapTotal;
-        uint64_t swapFree;
-    };
+    char magic[8];
+    uint32_t version;
+    uint32_t sequence; // seqlock: odd while a writer is updating the contents
+    uint64_t nowIs;
+    uint32_t sections;
+    uint32_t bytesUsed;
+};
 
-    RAM ram;
+struct StateSection
+{
+    StateId id;
+    uint32_t recordSize;
+    uint32_t count;
+    uint32_t offset;
+};
 
-    void readProc()
+template <typename T> struct Packed // how a container key or value is stored in the packed records
+{
+    typedef T type;
+    static void pack(const T& from, type& to) { to = from; }
+    static T unpack(const type& from) { return from; }
+};
+
+template <> struct Packed<std::string>
+{
+    struct type { char text[32]; };
+    static void pack(const std::string& from, type& to)
     {
-        std::vector<char> buffer;
-        readFile("/proc/meminfo", buffer);
-        std::istringstream meminfo(&buffer[0]);
-        bool hasAvailable = false;
-        std::string key;
-        for (int count = 0; meminfo >> key;)
-        {
-            if      (key == "MemTotal:")     { count++; meminfo >> ram.total;     }
-            else if (key == "MemFree:")      { count++; meminfo >> ram.free;      }
-            else if (key == "MemAvailable:") { count++; meminfo >> ram.available; hasAvailable = true; }
-            else if (key == "Buffers:")      { count++; meminfo >> ram.buffers;   }
-            else if (key == "Cached:")       { count++; meminfo >> ram.cached;    }
-            else if (key == "SwapTotal:")    { count++; meminfo >> ram.swapTotal; }
-            else if (key == "SwapFree:")     { count++; meminfo >> ram.swapFree;  }
-            else if (key == "Shmem:")        { count++; meminfo >> ram.shared;    }
-            if (count == 7 + (hasAvailable? 1:0)) break;
-            meminfo.ignore(buffer.size(), '\n');
-        }
-        if (!hasAvailable) ram.available = ram.free + ram.buffers + ram.cached; // pre-2014 kernels
+        memset(to.text, 0, sizeof(to.text));
+        from.copy(to.text, sizeof(to.text) - 1);
+    }
+    static std::string unpack(const type& from)
+    {
+        return std::string(from.text, strnlen(from.text, sizeof(from.text)));
     }
 };
 
-std::ostream& operator<<(std::ostream& out, const Memory::RAM& ram)
+template <typename K, typename V> struct StateRecord
 {
-    return out << ram.total << ' ' << ram.available << ' ' << ram.free << ' ' << ram.shared << ' '
-               << ram.buffers << ' ' << ram.cached << ' ' << ram.swapTotal << ' ' << ram.swapFree << '\n';
-}
+    typename Packed<K>::type key;
+    typename Packed<V>::type value;
+};
 
-std::istream& operator>>(std::istream& in, Memory::RAM& ram)
+class StateImage // encodes (decodes) sample containers into (from) the state file byte layout
 {
-    return in >> ram.total >> ram.available >> ram.free >> ram.shared
-              >> ram.buffers >> ram.cached >> ram.swapTotal >> ram.swapFree;
-}
+public:
+    StateImage() {}
+    StateImage(const std::vector<char>& raw) : image(raw) {}
 
-struct IO
-{
-    typedef std::string Name;
+    template <typename K, typename V> void add(StateId id, const std::map<K,V>& container)
+    {
+        std::vector<char> packed(container.size() * sizeof(StateRecord<K,V>));
+        StateRecord<K,V>* record = reinterpret_cast<StateRecord<K,V>*>(packed.data());
+        for (const auto& item : container)
+        {
+            Packed<K>::pack(item.first, record->key);
+            Packed<V>::pack(item.second, record->value);
+            record++;
+        }
+        sections.push_back(StateSection { id, uint32_t(sizeof(StateRecord<K,V>)), uint32_t(container.size()), 0 });
+        payloads.push_back(std::move(packed));
+    }
 
-    struct Device
+    template <typename T> void addArray(StateId id, const std::vector<T>& array) // trivially copyable items
     {
-        uint64_t bytesRead;
-        uint64_t bytesWritten;
-        uint32_t ioMsecs;
-        uint64_t bytesSize;
-    };
+        std::vector<char> packed(array.size() * sizeof(T));
+        if (!array.empty()) memcpy(packed.data(), array.data(), packed.size());
+        sections.push_back(StateSection { id, uint32_t(sizeof(T)), uint32_t(array.size()), 0 });
+        payloads.push_back(std::move(packed));
+    }
 
-    struct Bandwidth { double bytesPerSecond; };
+    template <typename V> void addRecord(StateId id, const V& value)
+    {
+        add(id, std::map<int32_t, V> { { 0, value } });
+    }
 
-    std::map<Name, Device> devices;
+    void addRaw(const StateImage& from, const StateSection& section) // copied through, not decoded
+    {
+        const char* data = &from.image[section.offset];
+        sections.push_back(StateSection { section.id, section.recordSize, section.count, 0 });
+        payloads.push_back(std::vector<char>(data, data + uint64_t(section.count) * section.recordSize));
+    }
 
-    void readProc()
+    std::vector<StateSection> table() const // of the valid sections
     {
-        std::vector<char> buffer;
-        readFile("/proc/diskstats", buffer);
-        std::string name, prev;
-        for (std::istringstream diskinfo(&buffer[0]);;) // search physical devices
+        std::vector<StateSection> found;
+        const StateHeader* header = reinterpret_cast<const StateHeader*>(image.data());
+        for (uint32_t i = 0; i < header->sections; i++)
         {
-            uint64_t skip;
-            if (!(diskinfo >> skip >> skip >> name)) break;
-            if (!name.empty()
-                && (prev.empty() || (name.find(prev) != 0)) // skip partitions
-                && (name.find("dm") != 0)) // skip device mapper
-            {
-                prev = name;
-                Device& device = devices[name];
-                uint64_t sectorsRd, sectorsWr;
-                diskinfo >> skip >> skip >> sectorsRd
-                         >> skip >> skip >> skip >> sectorsWr
-                         >> skip >> skip >> device.ioMsecs;
-                device.bytesRead = sectorsRd*512;
-                device.bytesWritten = sectorsWr*512;
-                device.bytesSize = 0;
-            }
-            diskinfo.ignore(buffer.size(), '\n');
+            StateSection section;
+            memcpy(&section, &image[sizeof(StateHeader) + i * sizeof(StateSection)], sizeof(section));
+            if (section.offset + uint64_t(section.count) * section.recordSize <= image.size()) found.push_back(section);
         }
-        readFile("/proc/partitions", buffer);
-        std::istringstream partinfo(&buffer[0]);
-        uint64_t blocks;
-        std::string skip;
-        bool hasData = false;
-        while (!hasData && std::getline(partinfo, skip)) if (skip.empty()) hasData = true;
-        if (hasData) while (partinfo >> skip >> skip >> blocks >> name)
+        return found;
+    }
+
+    const std::vector<char>& build(uint64_t nowIs)
+    {
+        std::size_t offset = sizeof(StateHeader) + sections.size() * sizeof(StateSection);
+        for (std::size_t i = 0; i < sections.size(); i++)
+        {
+            offset = (offset + 7) & ~std::size_t(7);
+            sections[i].offset = uint32_t(offset);
+            offset += payloads[i].size();
+        }
+        image.assign(offset, 0);
+        StateHeader* header = reinterpret_cast<StateHeader*>(image.data());
+        memcpy(header->magic, STATE_MAGIC, sizeof(header->magic));
+        header->version = STATE_VERSION;
+        header->nowIs = nowIs;
+        header->sections = uint32_t(sections.size());
+        header->bytesUsed = uint32_t(offset);
+        for (std::size_t i = 0; i < sections.size(); i++)
         {
-            auto pdev = devices.find(name);
-            if (pdev != devices.end()) pdev->second.bytesSize = blocks * 1024;
-            partinfo.ignore(buffer.size(), '\n');
+            memcpy(&image[sizeof(StateHeader) + i * sizeof(StateSection)], &sections[i], sizeof(StateSection));
+            if (!payloads[i].empty()) memcpy(&image[sections[i].offset], payloads[i].data(), payloads[i].size());
         }
+        return image;
     }
-};
-
-std::ostream& operator<<(std::ostream& out, const IO::Device& dev)
-{
-    return out << dev.bytesRead << ' ' << dev.bytesWritten << ' ' << dev.ioMsecs << ' ' << dev.bytesSize;
-}
-
-std::istream& operator>>(std::istream& in, IO::Device& dev)
-{
-    return in >> dev.bytesRead >> dev.bytesWritten >> dev.ioMsecs >> dev.bytesSize;
-}
 
-std::ostream& operator<<(std::ostream& out, const IO::Bandwidth& data)
-{
-    if (data.bytesPerSecond < MB_i)
-        return out << std::fixed << std::setprecision(1) << data.bytesPerSecond / MB_f << " MB/s";
-    if (data.bytesPerSecond < GB_i)
-        return out << int64_t(data.bytesPerSecond / MB_f) << " MB/s";
-    return out << std::fixed << std::setprecision(3) << data.bytesPerSecond / GB_f << " GB/s";
-}
+    bool valid() const
+    {
+        if (image.size() < sizeof(StateHeader)) return false;
+        const StateHeader* header = reinterpret_cast<const StateHeader*>(image.data());
+        return !memcmp(header->magic, STATE_MAGIC, sizeof(header->magic)) && (header->version == STATE_VERSION)
+            && (header->bytesUsed == image.size())
+            && (sizeof(StateHeader) + header->sections * sizeof(StateSection) <= image.size());
+    }
 
-struct Network
-{
-    typedef std::string Name;
+    uint64_t nowIs() const { return reinterpret_cast<const StateHeader*>(image.data())->nowIs; }
 
-    struct Interface
+    template <typename K, typename V> bool get(StateId id, std::map<K,V>& container) const
     {
-        uint64_t bytesRecv;
-        uint64_t bytesSent;
-        uint64_t traffic() const { return bytesRecv + bytesSent; }
-    };
+        StateSection section;
+        if (!find(id, sizeof(StateRecord<K,V>), section)) return false;
+        const StateRecord<K,V>* record = reinterpret_cast<const StateRecord<K,V>*>(image.data() + section.offset);
+        for (uint32_t r = 0; r < section.count; r++, record++)
+            container.insert(container.end(), { Packed<K>::unpack(record->key), Packed<V>::unpack(record->value) });
+        return true;
+    }
 
-    struct Bandwidth
+    template <typename T> bool getArray(StateId id, std::vector<T>& array) const
     {
-        enum class Unit { bit, byte } unit;
-        int64_t perSecond;
-    };
+        StateSection section;
+        if (!find(id, sizeof(T), section)) return false;
+        array.resize(section.count);
+        if (section.count) memcpy(array.data(), image.data() + section.offset, section.count * sizeof(T));
+        return true;
+    }
 
-    std::map<Name, Interface> interfaces;
+    template <typename V> bool getRecord(StateId id, V& value) const
+    {
+        std::map<int32_t, V> single;
+        if (!get(id, single) || single.empty()) return false;
+        value = single.begin()->second;
+        return true;
+    }
 
-    void readProc()
+private:
+    bool find(StateId id, std::size_t recordSize, StateSection& section) const
     {
-        std::vector<char> buffer;
-        readFile("/proc/net/dev", buffer);
-        std::istringstream netinfo(&buffer[0]);
-        netinfo.ignore(buffer.size(), '\n');
-        for (;;)
+        const StateHeader* header = reinterpret_cast<const StateHeader*>(image.data());
+        for (uint32_t i = 0; i < header->sections; i++)
         {
-            netinfo.ignore(buffer.size(), '\n');
-            std::string name;
-            if (!std::getline(netinfo, name, ':')) break; // also handles kernels not having a space after ':'
-            while (!name.empty() && (name.front() == ' ')) name.erase(name.begin()); // ltrim
-            Interface& interface = interfaces[name];
-            uint64_t skip;
-            netinfo >> interface.bytesRecv
-                    >> skip >> skip >> skip >> skip >> skip >> skip >> skip
-                    >> interface.bytesSent;
+            memcpy(&section, &image[sizeof(StateHeader) + i * sizeof(StateSection)], sizeof(section));
+            if (section.id != id) continue;
+            return (section.recordSize == recordSize)
+                && (section.offset + uint64_t(section.count) * section.recordSize <= image.size());
         }
+        return false;
     }
+
+    std::vector<StateSection> sections;
+    std::vector<std::vector<char>> payloads;
+    std::vector<char> image;
 };
 
-std::ostream& operator<<(std::ostream& out, const Network::Interface& ifz)
+class StateFile // mmap'ed state file updated in place with the seqlock protocol
 {
-    return out << ifz.bytesRecv << ' ' << ifz.bytesSent;
-}
+public:
+    StateFile() : fd(-1), writable(false), map(nullptr), mapSize(0) {}
+    ~StateFile() { close(); }
 
-std::istream& operator>>(std::istream& in, Network::Interface& ifz)
-{
-    return in >> ifz.bytesRecv >> ifz.bytesSent;
-}
+    bool open(const char* fileName, bool forWriting)
+    {
+        writable = forWriting;
+        fd = ::open(fileName, writable? O_RDWR | O_CREAT | O_CLOEXEC : O_RDONLY | O_CLOEXEC, 0640);
+        if (fd < 0) return false;
+        if (writable && (flock(fd, LOCK_EX) != 0)) { close(); return false; }
+        return remap(0);
+    }
+
+    bool read(std::vector<char>& image) // consistent snapshot of the used bytes (empty if none)
+    {
+        image.clear();
+        for (int attempt = 0; attempt < 1000; attempt++)
+        {
+            if (mapSize < sizeof(StateHeader)) return true;
+            StateHeader* header = static_cast<StateHeader*>(map);
+            uint32_t before = __atomic_load_n(&header->sequence, __ATOMIC_ACQUIRE);
+            if (before & 1) { sched_yield(); continue; }
+            uint32_t bytesUsed = header->bytesUsed;
+            if (memcmp(header->magic, STATE_MAGIC, sizeof(header->magic)) || (bytesUsed < sizeof(StateHeader)))
+                return true; // other format or never written
+            if (bytesUsed > mapSize) // grown by a writer since mapped
+            {
+                if (!remap(0)) return false;
+                continue;
+            }
+            image.assign(static_cast<char*>(map), static_cast<char*>(map) + bytesUsed);
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&header->sequence, __ATOMIC_RELAXED) == before) return true;
+        }
+        image.clear();
+        return false;
+    }
+
+    bool write(const std::vector<char>& image) // requires open(..., true)
+    {
+        if (!writable || (image.size() < sizeof(StateHeader))) return false;
+        if ((image.size() > mapSize) && !remap(image.size())) return false;
+        if (!map) return false;
+        StateHeader* header = static_cast<StateHeader*>(map);
+        uint32_t sequence = __atomic_load_n(&header->sequence, __ATOMIC_RELAXED) | 1;
+        __atomic_store_n(&header->sequence, sequence, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        std::size_t skip = offsetof(StateHeader, nowIs); // the sequence counter is not overwritten
+        memcpy(header->magic, image.data(), sizeof(header->magic));
+        header->version = reinterpret_cast<const StateHeader*>(image.data())->version;
+        memcpy(static_cast<char*>(map) + skip, image.data() + skip, image.size() - skip);
+        __atomic_store_n(&header->sequence, sequence + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+
+    void close()
+    {
+        if (map) munmap(map, mapSize);
+        if (fd >= 0) ::close(fd); // also releases the flock
+        map = nullptr;
+        mapSize = 0;
+        fd = -1;
+    }
+
+private:
+    bool remap(std::size_t minSize) // the file only grows: a shrink would fault the concurrent readers
+    {
+        if (map) munmap(map, mapSize);
+        map = nullptr;
+        mapSize = 0;
+        struct stat info;
+        if (fstat(fd, &info) != 0) return false;
+        std::size_t size = info.st_size;
+        if (size < minSize)
+        {
+            size = (minSize + 4095) & ~std::size_t(4095);
+            if (ftruncate(fd, size) != 0) return false;
+        }
+        if (size == 0) return true;
+        void* addr = mmap(nullptr, size, PROT_READ | (writable? PROT_WRITE : 0), MAP_SHARED, fd, 0);
+        if (addr == MAP_FAILED) return false;
+        map = addr;
+        mapSize = size;
+        return true;
+    }
+
+    int fd;
+    bool writable;
+    void* map;
+    std::size_t mapSize;
+};
+
+class Scanner // zero-copy cursor over a readFile() buffer: no locale, no temporaries, no heap allocations
+{
+public:
+    struct Token
+    {
+        const char* data;
+        std::size_t length;
+        bool empty() const { return length == 0; }
+        bool operator==(const char* text) const { return !strncmp(data, text, length) && !text[length]; }
+        bool operator!=(const char* text) const { return !(*this == text); }
+        bool startsWith(const char* text) const
+        {
+            std::size_t len = strlen(text);
+            return (length >= len) && !memcmp(data, text, len);
+        }
+        bool startsWith(const Token& that) const
+        {
+            return (length >= that.length) && !memcmp(data, that.data, that.length);
+        }
+        std::string str() const { return std::string(data, length); }
+    };
+
+    Scanner(const std::vector<char>& buffer) : pos(buffer.data()), end(buffer.data() + buffer.size()) {}
+    Scanner(const Token& token) : pos(token.data), end(token.data + token.length) {}
+
+    bool atEnd() const { return pos >= end; }
+
+    bool atEol() // nothing left in the current line
+    {
+        skipBlanks();
+        return (pos >= end) || (*pos == '\n');
+    }
+
+    void nextLine()
+    {
+        const char* eol = static_cast<const char*>(memchr(pos, '\n', end - pos));
+        pos = eol? eol + 1 : end;
+    }
+
+    Token word() // next whitespace delimited token (may cross lines, like operator>>)
+    {
+        while ((pos < end) && isSpace(*pos)) pos++;
+        const char* start = pos;
+        while ((pos < end) && !isSpace(*pos)) pos++;
+        return Token { start, std::size_t(pos - start) };
+    }
+
+    Token until(char delimiter) // rest of the line up to (and skipping) the delimiter, blanks trimmed on the left
+    {
+        skipBlanks();
+        const char* start = pos;
+        while ((pos < end) && (*pos != delimiter) && (*pos != '\n')) pos++;
+        Token token { start, std::size_t(pos - start) };
+        if ((pos < end) && (*pos == delimiter)) pos++;
+        return token;
+    }
+
+    Token line() { return until('\n'); }
+
+    bool number(uint64_t& value) // decimal integer in the current line
+    {
+        skipBlanks();
+        const char* start = pos;
+        uint64_t result = 0;
+        while ((pos < end) && (*pos >= '0') && (*pos <= '9')) result = result * 10 + (*pos++ - '0');
+        if (pos == start) return false;
+        value = result;
+        return true;
+    }
+
+    template <typename T> bool number(T& value) // signed and narrower integers
+    {
+        skipBlanks();
+        bool negative = (pos < end) && (*pos == '-');
+        if (negative) pos++;
+        uint64_t magnitude;
+        if (!number(magnitude)) return false;
+        value = T(negative? -int64_t(magnitude) : int64_t(magnitude));
+        return true;
+    }
+
+    bool decimal(double& value) // [-]digits[.digits]
+    {
+        int64_t integral;
+        if (!number(integral)) return false;
+        double fraction = 0;
+        if ((pos < end) && (*pos == '.'))
+        {
+            double scale = 1;
+            for (pos++; (pos < end) && (*pos >= '0') && (*pos <= '9'); pos++)
+            {
+                scale /= 10;
+                fraction += (*pos - '0') * scale;
+            }
+        }
+        value = integral < 0? integral - fraction : integral + fraction;
+        return true;
+    }
+
+    void skipFields(int count) { while (count-- > 0) word(); }
+
+private:
+    static bool isSpace(char c) { return (c == ' ') || (c == '\t') || (c == '\n') || (c == '\r'); }
+    void skipBlanks() { while ((pos < end) && ((*pos == ' ') || (*pos == '\t'))) pos++; }
+
+    const char* pos;
+    const char* end;
+};
+
+void splitList(const std::string& text, std::vector<std::string>& list) // comma separated, empty items dropped
+{
+    for (std::size_t start = 0; start <= text.length();)
+    {
+        std::size_t end = text.find(',', start);
+        if (end == std::string::npos) end = text.length();
+        if (end > start) list.push_back(text.substr(start, end - start));
+        start = end + 1;
+    }
+}
+
+void parseList(Scanner::Token text, std::vector<uint32_t>& numbers) // kernel cpu and node lists ("0-3,8")
+{
+    for (Scanner list(text); !list.atEnd();)
+    {
+        uint32_t first, last;
+        if (!list.number(first)) break;
+        last = first;
+        Scanner::Token range = list.until(',');
+        if (!range.empty() && (range.data[0] == '-'))
+            Scanner(Scanner::Token { range.data + 1, range.length - 1 }).number(last);
+        for (uint32_t number = first; number <= last; number++) numbers.push_back(number);
+    }
+}
+
+class NameFilter // comma separated include/exclude glob lists (an empty include list accepts everything)
+{
+public:
+    void include(const std::string& globs) { splitList(globs, included); }
+    void exclude(const std::string& globs) { splitList(globs, excluded); }
+    void always(const std::string& name) { if (!name.empty()) forced.push_back(name); }
+
+    bool accepts(const char* name) const
+    {
+        for (const auto& glob : forced)   if (glob == name) return true;
+        for (const auto& glob : excluded) if (!fnmatch(glob.c_str(), name, 0)) return false;
+        for (const auto& glob : included) if (!fnmatch(glob.c_str(), name, 0)) return true;
+        return included.empty();
+    }
+
+    bool accepts(const Scanner::Token& name) const // without allocations for the usual short names
+    {
+        if (forced.empty() && excluded.empty() && included.empty()) return true;
+        char text[64];
+        if (name.length >= sizeof(text)) return accepts(name.str().c_str());
+        memcpy(text, name.data, name.length);
+        text[name.length] = 0;
+        return accepts(text);
+    }
+
+    std::string signature() const // same signature, same names accepted
+    {
+        std::string text;
+        for (const auto& glob : included) text.append("+").append(glob);
+        for (const auto& glob : excluded) text.append("-").append(glob);
+        for (const auto& glob : forced)   text.append("=").append(glob);
+        return text;
+    }
+
+private:
+    std::vector<std::string> included, excluded, forced;
+};
+
+struct CPU : Sampled
+{
+    typedef int16_t Number; // 0,1,2,... for each core
+
+    struct Core
+    {
+        int64_t user, nice, system, idle, iowait, irq, softirq, steal, guest, guestnice;
+        uint64_t freq_hz;
+        int64_t cpuUsed()  const { return user + nice + system + irq + softirq + guest + guestnice; }
+        int64_t cpuTotal() const { return cpuUsed() + idle + iowait + steal; }
+        Core operator-(const Core& that) const
+        {
+            int64_t roundUserFix = user == that.user-1? 1 : 0; // compensate for physical host & virtual
+            int64_t roundNiceFix = nice == that.nice-1? 1 : 0; // guests counters evil rounding
+            return
+            {
+                user - that.user + roundUserFix, nice - that.nice + roundNiceFix, system - that.system,
+                idle - that.idle, iowait - that.iowait, irq - that.irq, softirq - that.softirq,
+                steal - that.steal, guest - that.guest + roundUserFix, guestnice - that.guestnice + roundNiceFix,
+                (freq_hz + that.freq_hz) / 2 // <-- a more useful abstraction
+            };
+        }
+    };
+
+    enum Counter { USER, NICE, SYSTEM, IDLE, IOWAIT, IRQ, SOFTIRQ, STEAL, GUEST, GUESTNICE, COUNTERS };
+
+    struct Throttling // CFS bandwidth control of a cgroup (zero without a cpu.max quota)
+    {
+        uint64_t periods;
+        uint64_t throttledPeriods;
+        uint64_t throttledUsecs;
+    };
+
+    Core all;                               // all cores summary
+    std::vector<int64_t> jiffies[COUNTERS]; // structure of arrays indexed by the core number
+    std::vector<uint64_t> freq_hz;
+    std::vector<uint8_t> online;            // offline cores leave holes in the numbering
+    Throttling throttling;
+
+    CPU() : all(), throttling() {}
+
+    std::size_t size() const { return online.size(); }
+
+    void resize(std::size_t cores)
+    {
+        for (auto& counter : jiffies) counter.resize(cores, 0);
+        freq_hz.resize(cores, 0);
+        online.resize(cores, 0);
+    }
+
+    void readProc(bool withFrequency)
+    {
+        std::vector<char> buffer;
+        readFile("/proc/stat", buffer);
+        bool found = false;
+        for (Scanner cpustat(buffer); !cpustat.atEnd(); cpustat.nextLine())
+        {
+            Scanner::Token name = cpustat.word();
+            if (!name.startsWith("cpu"))
+            {
+                if (found) break; else continue; // no more cpu lines (skip the huge "intr" one)
+            }
+            found = true;
+            int64_t values[COUNTERS] = { 0 };
+            for (int c = 0; c < COUNTERS; c++) if (!cpustat.number(values[c])) break; // caution with old kernels
+            values[USER] -= values[GUEST];     // adjust for the already accounted values (may cause evil rounding
+            values[NICE] -= values[GUESTNICE]; // effects, though)
+            if (name.length == 3)
+            {
+                all = Core { values[USER], values[NICE], values[SYSTEM], values[IDLE], values[IOWAIT], values[IRQ],
+                             values[SOFTIRQ], values[STEAL], values[GUEST], values[GUESTNICE], 0 };
+                continue;
+            }
+            Number number;
+            if (!Scanner(Scanner::Token { name.data + 3, name.length - 3 }).number(number) || (number < 0)) continue;
+            if (std::size_t(number) >= size()) resize(number + 1);
+            for (int c = 0; c < COUNTERS; c++) jiffies[c][number] = values[c];
+            online[number] = 1;
+        }
+        if (withFrequency && !readCpufreq(buffer)) readCpuinfo(buffer);
+    }
+
+    // A cgroup v2 has no per core figures: its usage (microseconds instead of jiffies) goes to the summary, whose
+    // idle time is what is left of the CPUs it may use (cpu.max quota, else its cpuset) since boot
+    void readCgroup(const std::string& cgroup, uint64_t nowIs)
+    {
+        std::vector<char> buffer;
+        uint64_t user = 0, system = 0;
+        if (readFile((cgroup + "/cpu.stat").c_str(), buffer, false))
+            for (Scanner cpustat(buffer); !cpustat.atEnd(); cpustat.nextLine())
+            {
+                Scanner::Token key = cpustat.word();
+                if      (key == "user_usec")      cpustat.number(user);
+                else if (key == "system_usec")    cpustat.number(system);
+                else if (key == "nr_periods")     cpustat.number(throttling.periods);
+                else if (key == "nr_throttled")   cpustat.number(throttling.throttledPeriods);
+                else if (key == "throttled_usec") cpustat.number(throttling.throttledUsecs);
+            }
+        double capacity = cgroupCapacity(cgroup, buffer);
+        all = Core { int64_t(user), 0, int64_t(system), 0, 0, 0, 0, 0, 0, 0, 0 };
+        all.idle = std::max<int64_t>(0, int64_t(capacity * (nowIs / 1000)) - all.cpuUsed());
+    }
+
+    static double cgroupCapacity(const std::string& cgroup, std::vector<char>& buffer) // in CPUs
+    {
+        uint64_t quota, period;
+        if (readFile((cgroup + "/cpu.max").c_str(), buffer, false))
+        {
+            Scanner cpumax(buffer);
+            if (cpumax.number(quota) && cpumax.number(period) && period) return 1.0 * quota / period;
+        }
+        std::vector<uint32_t> cpus;
+        if (readFile((cgroup + "/cpuset.cpus.effective").c_str(), buffer, false))
+            parseList(Scanner(buffer).line(), cpus);
+        return cpus.empty()? double(std::max(1L, sysconf(_SC_NPROCESSORS_ONLN))) : double(cpus.size());
+    }
+
+    // Per core jiffies elapsed since a previous sample (zero total if the core was not online in both). Plain
+    // loops over the contiguous counters, so the compiler can vectorize them.
+    void deltas(const CPU& old, std::vector<int64_t>& used, std::vector<int64_t>& total) const
+    {
+        std::size_t cores = std::min(size(), old.size());
+        used.assign(cores, 0);
+        total.assign(cores, 0);
+        for (int c = 0; c < COUNTERS; c++)
+        {
+            const int64_t* now = jiffies[c].data();
+            const int64_t* was = old.jiffies[c].data();
+            if ((c == IDLE) || (c == IOWAIT) || (c == STEAL))
+                for (std::size_t i = 0; i < cores; i++) total[i] += now[i] - was[i];
+            else
+                for (std::size_t i = 0; i < cores; i++) used[i] += now[i] - was[i];
+        }
+        for (int c : { USER, NICE }) // see Core::operator- (the fix is applied twice: also to the guest counter)
+        {
+            const int64_t* now = jiffies[c].data();
+            const int64_t* was = old.jiffies[c].data();
+            for (std::size_t i = 0; i < cores; i++) used[i] += now[i] == was[i] - 1? 2 : 0;
+        }
+        for (std::size_t i = 0; i < cores; i++)
+        {
+            total[i] += used[i];
+            if (!online[i] || !old.online[i]) total[i] = 0;
+        }
+    }
+
+    void pack(StateImage& state, uint32_t slot) const // jiffies flattened counter after counter
+    {
+        std::vector<int64_t> flat;
+        flat.reserve(COUNTERS * size());
+        for (const auto& counter : jiffies) flat.insert(flat.end(), counter.begin(), counter.end());
+        state.addRecord(StateId::CPU + slot, all);
+        state.addArray(StateId::CPUJiffies + slot, flat);
+        state.addArray(StateId::CPUFreq + slot, freq_hz);
+        state.addArray(StateId::CPUOnline + slot, online);
+        state.addRecord(StateId::CPUThrottling + slot, throttling);
+    }
+
+    bool unpack(const StateImage& state, uint32_t slot)
+    {
+        std::vector<int64_t> flat;
+        if (!state.getRecord(StateId::CPU + slot, all) || !state.getArray(StateId::CPUJiffies + slot, flat)
+            || !state.getArray(StateId::CPUFreq + slot, freq_hz) || !state.getArray(StateId::CPUOnline + slot, online)
+            || (freq_hz.size() != size()) || (flat.size() != COUNTERS * size())) return false;
+        for (int c = 0; c < COUNTERS; c++) jiffies[c].assign(flat.begin() + c * size(), flat.begin() + (c+1) * size());
+        state.getRecord(StateId::CPUThrottling + slot, throttling);
+        return true;
+    }
+
+    bool readCpufreq(std::vector<char>& buffer) // per-core sysfs files (no IPIs, no megabytes of flags)
+    {
+        uint64_t sum_freq = 0;
+        for (std::size_t number = 0; number < size(); number++)
+        {
+            if (!online[number]) continue;
+            uint64_t khz;
+            std::string file = "/sys/devices/system/cpu/cpu" + std::to_string(number) + "/cpufreq/scaling_cur_freq";
+            if (!readFile(file.c_str(), buffer, false) || !Scanner(buffer).number(khz)) return false;
+            freq_hz[number] = khz * 1000;
+            sum_freq += freq_hz[number];
+        }
+        all.freq_hz = sum_freq;
+        return true;
+    }
+
+    void readCpuinfo(std::vector<char>& buffer) // fallback when cpufreq is not available
+    {
+        readFile("/proc/cpuinfo", buffer);
+        uint64_t sum_freq = 0;
+        Number number = -1;
+        for (Scanner cpuinfo(buffer); !cpuinfo.atEnd(); cpuinfo.nextLine())
+        {
+            Scanner::Token key = cpuinfo.word();
+            if (key == "processor") { cpuinfo.word(); cpuinfo.number(number); }
+            else if ((key == "cpu") && (number >= 0) && (std::size_t(number) < size()) && (cpuinfo.word() == "MHz"))
+            {
+                double mhz;
+                cpuinfo.word();
+                if (!cpuinfo.decimal(mhz)) continue;
+                freq_hz[number] = uint64_t(mhz * MB_i);
+                sum_freq += freq_hz[number];
+                number = -1;
+            }
+        }
+        all.freq_hz = sum_freq;
+    }
+};
+
+struct Memory : Sampled
+{
+    struct RAM
+    {
+        uint64_t total;
+        uint64_t available;
+        uint64_t free;
+        uint64_t shared;
+        uint64_t buffers;
+        uint64_t cached;
+        uint64_t swapTotal;
+        uint64_t swapFree;
+    };
+
+    RAM ram;
+
+    void readProc()
+    {
+        std::vector<char> buffer;
+        readFile("/proc/meminfo", buffer);
+        bool hasAvailable = false;
+        Scanner meminfo(buffer);
+        for (int count = 0; !meminfo.atEnd(); meminfo.nextLine())
+        {
+            Scanner::Token key = meminfo.word();
+            if      (key == "MemTotal:")     { count++; meminfo.number(ram.total);     }
+            else if (key == "MemFree:")      { count++; meminfo.number(ram.free);      }
+            else if (key == "MemAvailable:") { count++; meminfo.number(ram.available); hasAvailable = true; }
+            else if (key == "Buffers:")      { count++; meminfo.number(ram.buffers);   }
+            else if (key == "Cached:")       { count++; meminfo.number(ram.cached);    }
+            else if (key == "SwapTotal:")    { count++; meminfo.number(ram.swapTotal); }
+            else if (key == "SwapFree:")     { count++; meminfo.number(ram.swapFree);  }
+            else if (key == "Shmem:")        { count++; meminfo.number(ram.shared);    }
+            if (count == 7 + (hasAvailable? 1:0)) break;
+        }
+        if (!hasAvailable) ram.available = ram.free + ram.buffers + ram.cached; // pre-2014 kernels
+    }
+
+    void readCgroup(const std::string& cgroup) // charged to a cgroup v2 (the host figures where it has no limits)
+    {
+        std::vector<char> buffer;
+        auto bytes = [&](const char* file, uint64_t& value) // false for "max"
+        {
+            return readFile((cgroup + file).c_str(), buffer, false) && Scanner(buffer).number(value);
+        };
+        uint64_t current = 0, limit = 0, swapCurrent = 0, swapLimit = 0, file = 0, inactiveFile = 0, shmem = 0;
+        bytes("/memory.current", current);
+        bytes("/memory.swap.current", swapCurrent);
+        bool limited = bytes("/memory.max", limit);
+        bool swapLimited = bytes("/memory.swap.max", swapLimit);
+        if (readFile((cgroup + "/memory.stat").c_str(), buffer, false))
+            for (Scanner memstat(buffer); !memstat.atEnd(); memstat.nextLine())
+            {
+                Scanner::Token key = memstat.word();
+                if      (key == "file")          memstat.number(file);
+                else if (key == "inactive_file") memstat.number(inactiveFile);
+                else if (key == "shmem")         memstat.number(shmem);
+            }
+        RAM host = RAM();
+        if (!limited || !swapLimited)
+        {
+            readProc();
+            host = ram;
+        }
+        ram = RAM();
+        ram.total = limited? limit / 1024 : host.total;
+        ram.available = ram.total - std::min(ram.total, (current - std::min(current, inactiveFile)) / 1024);
+        ram.free = ram.total - std::min(ram.total, current / 1024);
+        ram.cached = file / 1024;
+        ram.shared = shmem / 1024;
+        ram.swapTotal = swapLimited? swapLimit / 1024 : host.swapTotal;
+        ram.swapFree = ram.swapTotal - std::min(ram.swapTotal, swapCurrent / 1024);
+    }
+};
+
+struct IO : Sampled
+{
+    typedef std::string Name;
+
+    struct Device
+    {
+        uint64_t bytesRead;
+        uint64_t bytesWritten;
+        uint64_t reads, writes;         // completed requests
+        uint64_t readMsecs, writeMsecs; // spent by them (summed over the concurrent ones)
+        uint64_t ioMsecs;               // with requests in flight
+        uint64_t queueMsecs;            // weighted by the requests in flight
+        uint64_t bytesSize;
+    };
+
+    struct Activity // of a device over an interval
+    {
+        double iops;
+        double utilization;  // percentage of the time busy
+        double readAwait;    // average milliseconds per read
+        double writeAwait;
+        double queueDepth;   // average requests in flight
+    };
+
+    struct Block // classification of a diskstats entry, cached across samples
+    {
+        uint8_t wholeDisk;  // 0: partition or device mapper (not reported)
+        uint64_t bytesSize;
+    };
+
+    struct Bandwidth { double bytesPerSecond; };
+
+    static constexpr uint64_t RESCAN_NSECS = 60 * GB_i;
+
+    std::map<Name, Device> devices;
+    std::map<Name, Block> blocks;
+
+    static uint64_t delta(uint64_t now, uint64_t was) // 0 if reset (e.g. a device re-added under the same name)
+    {
+        return now >= was? now - was : 0;
+    }
+
+    static uint64_t msecsDelta(uint64_t now, uint64_t was) // the kernel prints the times as 32-bit: they wrap at 2^32
+    {
+        const uint64_t wrap = uint64_t(1) << 32;
+        return (now < was) && (was < wrap)? now + wrap - was : delta(now, was);
+    }
+
+    static Activity activity(const Device& now, const Device& was, double secs)
+    {
+        if ((now.reads < was.reads) || (now.writes < was.writes)) return Activity(); // reset: no interval
+        uint64_t reads = delta(now.reads, was.reads), writes = delta(now.writes, was.writes);
+        return Activity
+        {
+            (reads + writes) / secs, std::min(100.0, msecsDelta(now.ioMsecs, was.ioMsecs) / (secs * 10)),
+            reads? 1.0 * msecsDelta(now.readMsecs, was.readMsecs) / reads : 0,
+            writes? 1.0 * msecsDelta(now.writeMsecs, was.writeMsecs) / writes : 0,
+            msecsDelta(now.queueMsecs, was.queueMsecs) / (secs * 1000)
+        };
+    }
+    uint64_t scannedAt = 0;
+
+    void readProc(const IO* cached, uint64_t nowIs, const std::vector<Name>& selected, // selected: empty for all
+                  const std::string& cgroup) // cgroup v2 whose io.stat is read instead (empty for the whole system)
+    {
+        bool rescan = !cached || (nowIs - cached->scannedAt >= RESCAN_NSECS);
+        if (!rescan)
+        {
+            blocks = cached->blocks;
+            scannedAt = cached->scannedAt;
+        }
+        std::vector<char> buffer;
+        if (!cgroup.empty())
+        {
+            readFile((cgroup + "/io.stat").c_str(), buffer, false);
+            std::vector<char> uevent;
+            for (Scanner iostat(buffer); !iostat.atEnd(); iostat.nextLine())
+            {
+                Name name = deviceName(iostat.word(), uevent);
+                if (name.empty() || (!selected.empty() && (std::find(selected.begin(), selected.end(), name)
+                                                           == selected.end()))) continue;
+                Device& device = devices[name];
+                device = Device();
+                for (Scanner::Token key = iostat.until('='); !key.empty(); key = iostat.until('='))
+                {
+                    if (key == "rbytes") iostat.number(device.bytesRead);
+                    else if (key == "wbytes") iostat.number(device.bytesWritten);
+                    else if (key == "rios") iostat.number(device.reads);
+                    else if (key == "wios") iostat.number(device.writes);
+                    else iostat.word(); // (no times: latency and utilization are system wide only)
+                }
+                if (!blocks.count(name)) rescan = true;
+            }
+        }
+        else if (selected.empty())
+        {
+            readFile("/proc/diskstats", buffer);
+            for (Scanner diskinfo(buffer); !diskinfo.atEnd(); diskinfo.nextLine())
+            {
+                diskinfo.skipFields(2);
+                Scanner::Token name = diskinfo.word();
+                if (name.empty()) continue;
+                Name key = name.str();
+                auto itb = blocks.find(key);
+                if (itb == blocks.end()) rescan = true; // new device: classified below
+                else if (!itb->second.wholeDisk) continue;
+                readCounters(diskinfo, devices[key]);
+            }
+        }
+        else for (const auto& name : selected) // just the listed devices, skipping the whole diskstats table
+        {
+            if (!readFile(("/sys/block/" + name + "/stat").c_str(), buffer, false)) continue;
+            Scanner stat(buffer);
+            readCounters(stat, devices[name]);
+            if (!blocks.count(name)) rescan = true;
+        }
+        if (rescan) classify(nowIs);
+        for (auto itd = devices.begin(); itd != devices.end();)
+        {
+            auto itb = blocks.find(itd->first);
+            if ((itb == blocks.end()) || !itb->second.wholeDisk) itd = devices.erase(itd);
+            else (itd++)->second.bytesSize = itb->second.bytesSize;
+        }
+    }
+
+private:
+    static Name deviceName(Scanner::Token majorMinor, std::vector<char>& buffer) // "8:0" to "sda"
+    {
+        if (majorMinor.empty() || !readFile(("/sys/dev/block/" + majorMinor.str() + "/uevent").c_str(), buffer, false))
+            return Name();
+        for (Scanner uevent(buffer); !uevent.atEnd(); uevent.nextLine())
+            if (uevent.until('=') == "DEVNAME") return uevent.line().str();
+        return Name();
+    }
+
+    static void readCounters(Scanner& stat, Device& device) // /sys/block/<dev>/stat layout (diskstats after the name)
+    {
+        uint64_t sectorsRd = 0, sectorsWr = 0;
+        device = Device();
+        stat.number(device.reads);      stat.skipFields(1); stat.number(sectorsRd); stat.number(device.readMsecs);
+        stat.number(device.writes);     stat.skipFields(1); stat.number(sectorsWr); stat.number(device.writeMsecs);
+        stat.skipFields(1); stat.number(device.ioMsecs); stat.number(device.queueMsecs);
+        device.bytesRead = sectorsRd*512;
+        device.bytesWritten = sectorsWr*512;
+    }
+
+    void classify(uint64_t nowIs) // whole disks are the ones in /sys/block (device mapper excluded)
+    {
+        for (auto itb = blocks.begin(); itb != blocks.end();) // keeps the known partitions (skipped, not read)
+            itb = itb->second.wholeDisk || devices.count(itb->first)? blocks.erase(itb) : ++itb;
+        scannedAt = nowIs;
+        std::vector<char> buffer;
+        struct stat info;
+        if (stat(rooted("/sys/block").c_str(), &info) == 0)
+        {
+            for (const auto& itd : devices)
+            {
+                Block& block = blocks[itd.first];
+                uint64_t sectors = 0;
+                block.wholeDisk = itd.first.compare(0, 2, "dm")
+                                  && readFile(("/sys/block/" + itd.first + "/size").c_str(), buffer, false)
+                                  && Scanner(buffer).number(sectors);
+                block.bytesSize = sectors * 512;
+            }
+            return;
+        }
+        const Name* prev = nullptr; // no sysfs: partitions follow their disk and extend its name
+        for (const auto& itd : devices)
+        {
+            bool partition = prev && !itd.first.compare(0, prev->length(), *prev);
+            blocks[itd.first] = Block { uint8_t(!partition && itd.first.compare(0, 2, "dm")), 0 };
+            if (!partition) prev = &itd.first;
+        }
+        readFile("/proc/partitions", buffer);
+        Scanner partinfo(buffer);
+        while (!partinfo.atEnd() && !partinfo.atEol()) partinfo.nextLine(); // header
+        for (partinfo.nextLine(); !partinfo.atEnd(); partinfo.nextLine())
+        {
+            uint64_t kbytes;
+            partinfo.skipFields(2);
+            if (!partinfo.number(kbytes)) continue;
+            auto itb = blocks.find(partinfo.word().str());
+            if (itb != blocks.end()) itb->second.bytesSize = kbytes * 1024;
+        }
+    }
+};
+
+Output& operator<<(Output& out, const IO::Bandwidth& data)
+{
+    if (data.bytesPerSecond < MB_i) return out << Fixed { data.bytesPerSecond / MB_f, 1 } << " MB/s";
+    if (data.bytesPerSecond < GB_i) return out << int64_t(data.bytesPerSecond / MB_f) << " MB/s";
+    return out << Fixed { data.bytesPerSecond / GB_f, 3 } << " GB/s";
+}
+
+struct Network : Sampled
+{
+    typedef std::string Name;
+
+    struct Interface
+    {
+        uint64_t bytesRecv;
+        uint64_t bytesSent;
+        uint64_t packetsRecv, packetsSent;
+        uint64_t errorsRecv, errorsSent;
+        uint64_t dropsRecv, dropsSent;
+        uint64_t traffic() const { return bytesRecv + bytesSent; }
+        uint64_t losses() const { return errorsRecv + errorsSent + dropsRecv + dropsSent; }
+    };
+
+    struct Bandwidth
+    {
+        enum class Unit { bit, byte } unit;
+        int64_t perSecond;
+    };
+
+    std::map<Name, Interface> interfaces;
+
+    void readProc(const NameFilter& filter)
+    {
+        if (!sourceRoot.empty() || !readNetlink(filter)) readNetDev(filter); // (fixtures only have the files)
+    }
+
+    bool readNetlink(const NameFilter& filter) // RTM_GETLINK dump: binary IFLA_STATS64 counters, no text parsing
+    {
+        static int socketFd = -1; // kept by the daemon
+        static uint32_t sequence = 0;
+        if (socketFd < 0) socketFd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+        if (socketFd < 0) return false;
+
+        struct { nlmsghdr header; ifinfomsg info; } request;
+        memset(&request, 0, sizeof(request));
+        request.header.nlmsg_len = sizeof(request);
+        request.header.nlmsg_type = RTM_GETLINK;
+        request.header.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+        request.header.nlmsg_seq = ++sequence;
+        request.info.ifi_family = AF_UNSPEC;
+
+        bool done = false;
+        bool failed = send(socketFd, &request, sizeof(request), 0) != sizeof(request);
+        std::vector<char> buffer(65536);
+        while (!done && !failed) // a multipart dump spans several datagrams
+        {
+            ssize_t bytes = recv(socketFd, buffer.data(), buffer.size(), 0);
+            if (timings)
+            {
+                std::lock_guard<std::mutex> lock(filesLock);
+                timings->reads++;
+                if (bytes > 0) timings->bytesRead["netlink RTM_GETLINK"] += bytes;
+            }
+            if (bytes <= 0) { failed = true; break; }
+            int length = int(bytes);
+            for (nlmsghdr* msg = reinterpret_cast<nlmsghdr*>(buffer.data());
+                 !done && !failed && NLMSG_OK(msg, length); msg = NLMSG_NEXT(msg, length))
+            {
+                if (msg->nlmsg_seq != sequence) continue;
+                if (msg->nlmsg_type == NLMSG_DONE) done = true;
+                else if (msg->nlmsg_type == NLMSG_ERROR) failed = true;
+                else if (msg->nlmsg_type == RTM_NEWLINK) parseLink(msg, filter);
+            }
+        }
+        if (!keepFilesOpen || failed)
+        {
+            close(socketFd);
+            socketFd = -1;
+        }
+        if (failed) interfaces.clear();
+        return !failed;
+    }
+
+    void parseLink(nlmsghdr* msg, const NameFilter& filter)
+    {
+        ifinfomsg* info = static_cast<ifinfomsg*>(NLMSG_DATA(msg));
+        int length = IFLA_PAYLOAD(msg);
+        const char* name = nullptr;
+        const void* stats = nullptr;
+        for (rtattr* attr = IFLA_RTA(info); RTA_OK(attr, length); attr = RTA_NEXT(attr, length))
+        {
+            if (attr->rta_type == IFLA_IFNAME) name = static_cast<const char*>(RTA_DATA(attr));
+            else if ((attr->rta_type == IFLA_STATS64) && (RTA_PAYLOAD(attr) >= sizeof(rtnl_link_stats64)))
+                stats = RTA_DATA(attr);
+        }
+        if (!name || !stats || !filter.accepts(name)) return;
+        rtnl_link_stats64 counters; // the attribute is only 4-byte aligned
+        memcpy(&counters, stats, sizeof(counters));
+        Interface& interface = interfaces[name];
+        interface.bytesRecv = counters.rx_bytes;
+        interface.bytesSent = counters.tx_bytes;
+        interface.packetsRecv = counters.rx_packets;
+        interface.packetsSent = counters.tx_packets;
+        interface.errorsRecv = counters.rx_errors;
+        interface.errorsSent = counters.tx_errors;
+        interface.dropsRecv = counters.rx_dropped;
+        interface.dropsSent = counters.tx_dropped;
+    }
+
+    void readNetDev(const NameFilter& filter)
+    {
+        std::vector<char> buffer;
+        readFile("/proc/net/dev", buffer);
+        Scanner netinfo(buffer);
+        netinfo.nextLine();
+        for (netinfo.nextLine(); !netinfo.atEnd(); netinfo.nextLine())
+        {
+            Scanner::Token name = netinfo.until(':'); // also handles kernels not having a space after ':'
+            if (name.empty() || !filter.accepts(name)) continue;
+            Interface& interface = interfaces[name.str()];
+            netinfo.number(interface.bytesRecv);
+            netinfo.number(interface.packetsRecv);
+            netinfo.number(interface.errorsRecv);
+            netinfo.number(interface.dropsRecv);
+            netinfo.skipFields(4); // fifo frame compressed multicast
+            netinfo.number(interface.bytesSent);
+            netinfo.number(interface.packetsSent);
+            netinfo.number(interface.errorsSent);
+            netinfo.number(interface.dropsSent);
+        }
+    }
+};
+
+Output& operator<<(Output& out, const Network::Bandwidth& speed)
+{
+    char unit = (speed.unit == Network::Bandwidth::Unit::bit)? 'b' : 'B';
+    if (speed.perSecond < MB_i) return out << speed.perSecond / 1000 << " K" << unit << "ps";
+    return out << Fixed { speed.perSecond / MB_f, 3 } << " M" << unit << "ps";
+}
+
+struct Health : Sampled
+{
+    typedef std::string Name;
+
+    struct Thermometer
+    {
+        int32_t tempMilliCelsius;
+    };
+
+    struct Source // where the coretemp sensors were found, cached across samples
+    {
+        int32_t hwmon;      // -1 if there is none
+        int32_t legacy;     // pre-3.15 kernel: attributes below "device"
+        uint64_t inode;     // of the "name" attribute: changes if the driver is reloaded
+        uint64_t scannedAt;
+    };
+
+    static constexpr uint64_t RESCAN_NSECS = 60 * GB_i;
+
+    std::map<Name, Thermometer> thermometers;
+    Source source;
+    std::map<int32_t, Name> labels; // temp<index>_label of the coretemp sensors
+
+    std::string directory() const
+    {
+        return "/sys/class/hwmon/hwmon" + std::to_string(source.hwmon) + (source.legacy? "/device" : "");
+    }
+
+    static uint64_t inodeOf(const std::string& file)
+    {
+        struct stat info;
+        return stat(rooted(file).c_str(), &info) == 0? info.st_ino : 0;
+    }
+
+    bool stillValid(uint64_t nowIs) const
+    {
+        if (nowIs - source.scannedAt >= RESCAN_NSECS) return false;
+        return (source.hwmon < 0) || (inodeOf(directory() + "/name") == source.inode);
+    }
+
+    void discover(uint64_t nowIs)
+    {
+        source = Source { -1, 0, 0, nowIs };
+        labels.clear();
+        std::vector<char> buffer;
+        for (int hwmon = 0; hwmon < 256; hwmon++)
+        {
+            source.hwmon = hwmon;
+            source.legacy = 0;
+            if (!readFile((directory() + "/name").c_str(), buffer, false)) // pre-3.15 kernel?
+            {
+                source.legacy = 1;
+                if (!readFile((directory() + "/name").c_str(), buffer, false)) break;
+            }
+            if (Scanner(buffer).word() == "coretemp")
+            {
+                source.inode = inodeOf(directory() + "/name");
+                break;
+            }
+        }
+        if (!source.inode)
+        {
+            source.hwmon = -1;
+            return;
+        }
+
+        std::string coretemp = directory();
+        for (int ic = 1; ic < 64; ic++)
+        {
+            if (!readFile((coretemp + "/temp" + std::to_string(ic) + "_label").c_str(), buffer, false))
+            {
+                if (labels.empty()) continue; else break; // Atom CPU may start at 2 (!?)
+            }
+            Scanner::Token label = Scanner(buffer).line();
+            if (label.empty()) break;
+            labels[ic] = label.str();
+        }
+    }
+
+    void readProc(const Health* cached, uint64_t nowIs) // only the _input files unless the sensors changed
+    {
+        if (cached && cached->stillValid(nowIs))
+        {
+            source = cached->source;
+            labels = cached->labels;
+        }
+        else discover(nowIs);
+
+        std::string coretemp = directory();
+        std::vector<char> buffer;
+        for (const auto& itl : labels)
+        {
+            if (!readFile((coretemp + "/temp" + std::to_string(itl.first) + "_input").c_str(), buffer, false)) break;
+            int32_t tempMilliCelsius;
+            if (!Scanner(buffer).number(tempMilliCelsius)) break;
+            thermometers[itl.second].tempMilliCelsius = tempMilliCelsius;
+        }
+    }
+};
+
+struct Processes : Sampled // per task counters for the TOP lists (scales to tens of thousands of processes)
+{
+    struct Counters // sorted by pid (the /proc directory order)
+    {
+        int32_t pid;
+        uint32_t hasIo;      // /proc/<pid>/io is only readable for the own processes (unless root)
+        uint64_t startTicks; // tells a reused pid apart
+        uint64_t cpuTicks;   // utime + stime
+        uint64_t bytesRead;
+        uint64_t bytesWritten;
+        char comm[16];
+    };
+
+    struct Ranked
+    {
+        const Counters* task;
+        uint64_t delta; // CPU ticks, or bytes read plus written
+        uint64_t bytesRead, bytesWritten;
+    };
+
+    std::vector<Counters> tasks;
+
+    // getdents64 over a held /proc descriptor, then openat() relative to it (only the tasks of the cgroup, if any)
+    void readProc(bool withIo, const std::string& cgroup)
+    {
+        std::vector<int32_t> members;
+        if (!cgroup.empty())
+        {
+            cgroupMembers(cgroup, members);
+            std::sort(members.begin(), members.end());
+        }
+        static int procFd = -1; // kept by the daemon
+        if (procFd < 0) procFd = open(rooted("/proc").c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        else lseek(procFd, 0, SEEK_SET);
+        if (procFd < 0) return;
+        uint64_t opens = 0, bytesStat = 0, bytesIo = 0;
+        alignas(dirent64) char entries[32768];
+        for (long bytes; (bytes = syscall(SYS_getdents64, procFd, entries, sizeof(entries))) > 0;)
+        {
+            for (long offset = 0; offset < bytes;)
+            {
+                const dirent64* entry = reinterpret_cast<const dirent64*>(entries + offset);
+                offset += entry->d_reclen;
+                int32_t pid = 0;
+                const char* digit = entry->d_name;
+                for (; (*digit >= '0') && (*digit <= '9'); digit++) pid = pid * 10 + (*digit - '0');
+                if (*digit || !pid) continue;
+                if (!cgroup.empty() && !std::binary_search(members.begin(), members.end(), pid)) continue;
+                tasks.push_back(Counters());
+                Counters& task = tasks.back();
+                task.pid = pid;
+                opens++;
+                if (!readStat(procFd, pid, task, bytesStat)) { tasks.pop_back(); continue; }
+                if (withIo) opens++, task.hasIo = readIo(procFd, pid, task, bytesIo);
+            }
+        }
+        if (!keepFilesOpen)
+        {
+            close(procFd);
+            procFd = -1;
+        }
+        if (!std::is_sorted(tasks.begin(), tasks.end(), [](const Counters& a, const Counters& b)
+                            { return a.pid < b.pid; }))
+            std::sort(tasks.begin(), tasks.end(), [](const Counters& a, const Counters& b) { return a.pid < b.pid; });
+        if (timings)
+        {
+            std::lock_guard<std::mutex> lock(filesLock);
+            timings->opens += opens;
+            timings->reads += opens;
+            timings->bytesRead["/proc/<pid>/stat"] += bytesStat;
+            if (withIo) timings->bytesRead["/proc/<pid>/io"] += bytesIo;
+        }
+    }
+
+    // The heaviest tasks since an older sample (a bounded min-heap: no sorting of the whole process list)
+    std::vector<Ranked> top(const Processes& old, std::size_t count, bool byIo) const
+    {
+        std::vector<Ranked> heap;
+        if (!count) return heap;
+        heap.reserve(count + 1);
+        auto heavier = [](const Ranked& a, const Ranked& b) { return a.delta > b.delta; };
+        auto ito = old.tasks.begin();
+        for (const auto& task : tasks)
+        {
+            while ((ito != old.tasks.end()) && (ito->pid < task.pid)) ++ito;
+            if ((ito == old.tasks.end()) || (ito->pid != task.pid) || (ito->startTicks != task.startTicks)) continue;
+            if (byIo && (!task.hasIo || !ito->hasIo)) continue;
+            Ranked ranked = { &task, task.cpuTicks - ito->cpuTicks, 0, 0 };
+            if (byIo)
+            {
+                ranked.bytesRead = task.bytesRead - ito->bytesRead;
+                ranked.bytesWritten = task.bytesWritten - ito->bytesWritten;
+                ranked.delta = ranked.bytesRead + ranked.bytesWritten;
+            }
+            if (!ranked.delta || ((heap.size() == count) && (ranked.delta <= heap.front().delta))) continue;
+            heap.push_back(ranked);
+            std::push_heap(heap.begin(), heap.end(), heavier);
+            if (heap.size() > count)
+            {
+                std::pop_heap(heap.begin(), heap.end(), heavier);
+                heap.pop_back();
+            }
+        }
+        std::sort_heap(heap.begin(), heap.end(), heavier); // heaviest first
+        return heap;
+    }
+
+private:
+    static void cgroupMembers(const std::string& cgroup, std::vector<int32_t>& pids) // of its whole subtree
+    {
+        std::vector<char> buffer;
+        if (readFile((cgroup + "/cgroup.procs").c_str(), buffer, false))
+            for (Scanner procs(buffer); !procs.atEnd(); procs.nextLine())
+            {
+                int32_t pid;
+                if (procs.number(pid)) pids.push_back(pid);
+            }
+        DIR* directory = opendir(rooted(cgroup).c_str());
+        if (!directory) return;
+        while (const dirent* entry = readdir(directory))
+            if ((entry->d_type == DT_DIR) && (entry->d_name[0] != '.'))
+                cgroupMembers(cgroup + "/" + entry->d_name, pids);
+        closedir(directory);
+    }
+
+    static ssize_t readAt(int dirFd, int32_t pid, const char* file, char* buffer, std::size_t size)
+    {
+        char path[64];
+        snprintf(path, sizeof(path), "%d/%s", int(pid), file);
+        int fd = openat(dirFd, path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return -1;
+        ssize_t bytes = ::read(fd, buffer, size);
+        close(fd);
+        return bytes;
+    }
+
+    static bool readStat(int dirFd, int32_t pid, Counters& task, uint64_t& bytesRead)
+    {
+        char buffer[1024];
+        ssize_t bytes = readAt(dirFd, pid, "stat", buffer, sizeof(buffer));
+        if (bytes <= 0) return false;
+        bytesRead += bytes;
+        const char* open = static_cast<const char*>(memchr(buffer, '(', bytes));
+        const char* close = static_cast<const char*>(memrchr(buffer, ')', bytes)); // (the name may contain any)
+        if (!open || !close || (close < open)) return false;
+        std::size_t length = std::min<std::size_t>(close - open - 1, sizeof(task.comm) - 1);
+        memcpy(task.comm, open + 1, length);
+        task.comm[length] = 0;
+        uint64_t utime = 0, stime = 0;
+        Scanner stat(Scanner::Token { close + 1, std::size_t(buffer + bytes - close - 1) });
+        stat.skipFields(11); // state ... cmajflt
+        stat.number(utime);
+        stat.number(stime);
+        stat.skipFields(6);  // cutime ... itrealvalue
+        task.cpuTicks = utime + stime;
+        return stat.number(task.startTicks);
+    }
+
+    static bool readIo(int dirFd, int32_t pid, Counters& task, uint64_t& bytesRead)
+    {
+        char buffer[512];
+        ssize_t bytes = readAt(dirFd, pid, "io", buffer, sizeof(buffer));
+        if (bytes <= 0) return false;
+        bytesRead += bytes;
+        int found = 0;
+        for (Scanner io(Scanner::Token { buffer, std::size_t(bytes) }); !io.atEnd() && (found < 2); io.nextLine())
+        {
+            Scanner::Token key = io.word();
+            if (key == "read_bytes:") found += io.number(task.bytesRead);
+            else if (key == "write_bytes:") found += io.number(task.bytesWritten);
+        }
+        return found == 2;
+    }
+};
+
+struct Pressure : Sampled // Pressure Stall Information (Linux 4.20+)
+{
+    enum Resource { CPU_STALLS, MEMORY_STALLS, IO_STALLS, RESOURCES };
+
+    struct Stall
+    {
+        uint32_t available;
+        double avg10, avg60;  // percentages averaged by the kernel
+        uint64_t totalUsecs;  // stalled time since boot
+    };
+
+    static const char* name(int resource)
+    {
+        static const char* names[RESOURCES] = { "cpu", "memory", "io" };
+        return names[resource];
+    }
+
+    std::vector<Stall> some, full; // indexed by Resource
+
+    void readProc(const std::string& cgroup) // the <resource>.pressure files of a cgroup v2 (empty: system wide)
+    {
+        some.assign(RESOURCES, Stall());
+        full.assign(RESOURCES, Stall());
+        std::vector<char> buffer;
+        for (int resource = 0; resource < RESOURCES; resource++)
+        {
+            std::string file = cgroup.empty()? std::string("/proc/pressure/") + name(resource)
+                                             : cgroup + "/" + name(resource) + ".pressure";
+            if (!readFile(file.c_str(), buffer, false)) continue;
+            for (Scanner pressure(buffer); !pressure.atEnd(); pressure.nextLine())
+            {
+                Scanner::Token kind = pressure.word();
+                Stall& stall = kind == "some"? some[resource] : full[resource];
+                if ((kind != "some") && (kind != "full")) continue;
+                stall.available = 1;
+                for (Scanner::Token key = pressure.until('='); !key.empty(); key = pressure.until('='))
+                {
+                    if (key == "avg10") pressure.decimal(stall.avg10);
+                    else if (key == "avg60") pressure.decimal(stall.avg60);
+                    else if (key == "total") pressure.number(stall.totalUsecs);
+                    else pressure.word();
+                }
+            }
+        }
+    }
+};
+
+struct Numa : Sampled // per node memory and page allocation counters, plus the cached core to node topology
+{
+    struct Node
+    {
+        uint64_t totalKb;
+        uint64_t freeKb;
+        uint64_t numaMiss;    // pages allocated here although another node was preferred
+        uint64_t numaForeign; // pages preferring this node allocated elsewhere
+        uint64_t otherNode;   // pages allocated here by processes running on another node
+    };
+
+    static constexpr uint64_t RESCAN_NSECS = 60 * GB_i;
+
+    std::map<int32_t, Node> nodes;
+    std::vector<int16_t> nodeOfCore; // indexed by the core number (-1: unknown)
+    uint64_t scannedAt = 0;
+
+    void readProc(const Numa* cached, uint64_t nowIs)
+    {
+        std::vector<char> buffer;
+        if (cached && (nowIs - cached->scannedAt < RESCAN_NSECS)) // CPU hotplug keeps the node of each core
+        {
+            nodeOfCore = cached->nodeOfCore;
+            scannedAt = cached->scannedAt;
+            for (const auto& itn : cached->nodes) nodes[itn.first] = Node();
+        }
+        else discover(nowIs, buffer);
+
+        for (auto& itn : nodes)
+        {
+            std::string directory = "/sys/devices/system/node/node" + std::to_string(itn.first);
+            Node& node = itn.second;
+            if (readFile((directory + "/meminfo").c_str(), buffer, false))
+                for (Scanner meminfo(buffer); !meminfo.atEnd(); meminfo.nextLine()) // "Node 0 MemTotal: ... kB"
+                {
+                    meminfo.skipFields(2);
+                    Scanner::Token key = meminfo.word();
+                    if (key == "MemTotal:") meminfo.number(node.totalKb);
+                    else if (key == "MemFree:") { meminfo.number(node.freeKb); break; }
+                }
+            if (readFile((directory + "/numastat").c_str(), buffer, false))
+                for (Scanner numastat(buffer); !numastat.atEnd(); numastat.nextLine())
+                {
+                    Scanner::Token key = numastat.word();
+                    if (key == "numa_miss") numastat.number(node.numaMiss);
+                    else if (key == "numa_foreign") numastat.number(node.numaForeign);
+                    else if (key == "other_node") numastat.number(node.otherNode);
+                }
+        }
+    }
+
+private:
+    void discover(uint64_t nowIs, std::vector<char>& buffer)
+    {
+        scannedAt = nowIs;
+        nodeOfCore.clear();
+        std::vector<uint32_t> online, cores;
+        if (readFile("/sys/devices/system/node/online", buffer, false)) parseList(Scanner(buffer).line(), online);
+        for (uint32_t number : online)
+        {
+            nodes[number] = Node();
+            cores.clear();
+            std::string cpulist = "/sys/devices/system/node/node" + std::to_string(number) + "/cpulist";
+            if (readFile(cpulist.c_str(), buffer, false)) parseList(Scanner(buffer).line(), cores);
+            for (uint32_t core : cores)
+            {
+                if (core >= nodeOfCore.size()) nodeOfCore.resize(core + 1, -1);
+                nodeOfCore[core] = int16_t(number);
+            }
+        }
+    }
+};
+
+struct Throttle : Sampled // thermal throttling events and frequency caps of each core
+{
+    struct Core
+    {
+        uint64_t coreEvents;    // thermal_throttle/core_throttle_count
+        uint64_t packageEvents; // thermal_throttle/package_throttle_count (the same for the cores of a package)
+        uint32_t maxKhz;        // scaling_max_freq: lowered by the policy (or the thermal drivers) to cap the core
+        uint32_t hwMaxKhz;      // cpuinfo_max_freq (cached with the package)
+        int32_t package;        // -1: not online when discovered
+    };
+
+    static constexpr uint64_t RESCAN_NSECS = 60 * GB_i;
+
+    std::vector<Core> cores; // indexed by the core number
+    uint64_t scannedAt = 0;
+
+    bool capped(std::size_t number) const
+    {
+        return (number < cores.size()) && cores[number].maxKhz && (cores[number].maxKhz < cores[number].hwMaxKhz);
+    }
+
+    bool throttledSince(const Throttle& old, std::size_t number) const
+    {
+        if ((number >= cores.size()) || (number >= old.cores.size())) return false;
+        return (cores[number].coreEvents > old.cores[number].coreEvents)
+            || (cores[number].packageEvents > old.cores[number].packageEvents);
+    }
+
+    void readProc(const Throttle* cached, uint64_t nowIs)
+    {
+        std::vector<char> buffer;
+        if (cached && (nowIs - cached->scannedAt < RESCAN_NSECS))
+        {
+            cores = cached->cores;
+            scannedAt = cached->scannedAt;
+        }
+        else discover(nowIs, buffer);
+
+        for (std::size_t number = 0; number < cores.size(); number++)
+        {
+            Core& core = cores[number];
+            if (core.package < 0) continue;
+            std::string directory = "/sys/devices/system/cpu/cpu" + std::to_string(number);
+            core.coreEvents = core.packageEvents = 0;
+            core.maxKhz = 0;
+            if (readFile((directory + "/thermal_throttle/core_throttle_count").c_str(), buffer, false))
+                Scanner(buffer).number(core.coreEvents);
+            if (readFile((directory + "/thermal_throttle/package_throttle_count").c_str(), buffer, false))
+                Scanner(buffer).number(core.packageEvents);
+            if (readFile((directory + "/cpufreq/scaling_max_freq").c_str(), buffer, false))
+                Scanner(buffer).number(core.maxKhz);
+        }
+    }
+
+private:
+    void discover(uint64_t nowIs, std::vector<char>& buffer)
+    {
+        scannedAt = nowIs;
+        cores.clear();
+        std::vector<uint32_t> online;
+        if (readFile("/sys/devices/system/cpu/online", buffer, false)) parseList(Scanner(buffer).line(), online);
+        for (uint32_t number : online)
+        {
+            if (number >= cores.size()) cores.resize(number + 1, Core { 0, 0, 0, 0, -1 });
+            Core& core = cores[number];
+            std::string directory = "/sys/devices/system/cpu/cpu" + std::to_string(number);
+            core.package = 0;
+            if (readFile((directory + "/topology/physical_package_id").c_str(), buffer, false))
+                Scanner(buffer).number(core.package);
+            if (readFile((directory + "/cpufreq/cpuinfo_max_freq").c_str(), buffer, false))
+                Scanner(buffer).number(core.hwMaxKhz);
+        }
+    }
+};
 
-std::ostream& operator<<(std::ostream& out, const Network::Bandwidth& speed)
+struct DataSize { uint64_t bytes; };
+
+Output& operator<<(Output& out, const DataSize& data)
 {
-    char unit = (speed.unit == Network::Bandwidth::Unit::bit)? 'b' : 'B';
-    if (speed.perSecond < MB_i) return out << speed.perSecond / 1000 << " K" << unit << "ps";
-    return out << std::fixed << std::setprecision(3) << speed.perSecond / MB_f << " M" << unit << "ps";
+    if (data.bytes <     5000) return out << "0 MB";
+    if (data.bytes <  10*MB_i) return out << Fixed { data.bytes / MB_f, 2 } << " MB";
+    if (data.bytes < 100*MB_i) return out << Fixed { data.bytes / MB_f, 1 } << " MB";
+    if (data.bytes <     GB_i) return out << data.bytes / MB_i << " MB";
+    if (data.bytes <  10*GB_i) return out << Fixed { data.bytes / GB_f, 2 } << " GB";
+    if (data.bytes < 100*GB_i) return out << Fixed { data.bytes / GB_f, 1 } << " GB";
+    if (data.bytes <     TB_i) return out << data.bytes / GB_i << " GB";
+    uint64_t tbx100 = data.bytes / (TB_i / 100);
+    auto decimals = (tbx100 > 9999) || (tbx100 % 100 == 0)? 0 : (tbx100 % 10 == 0)? 1 : 2; // pretty disk sizes
+    return out << Fixed { data.bytes / TB_f, decimals } << " TB";
 }
 
-struct Health
+template <typename T> struct Padded { uint64_t max; T value; int decimals; }; // decimals: floating point only
+
+void padDigits(Output& out, uint64_t max, double value)
 {
-    typedef std::string Name;
+    if (!std::isnan(value)) for (double div = max;; div /= 10) // avoid infinite loop with NaN numbers
+    {
+        if ((value >= div) && (value >= 1)) break;
+        if ((value < 1) && (div <= 1)) break;
+        out << "  "; // two spaces in place of each missing digit (same width in XFCE Generic Monitor applet)
+    }
+}
 
-    struct Thermometer
+template <typename T> Output& operator<<(Output& out, const Padded<T>& data)
+{
+    padDigits(out, data.max, double(data.value));
+    return out << data.value;
+}
+
+Output& operator<<(Output& out, const Padded<double>& data)
+{
+    padDigits(out, data.max, data.value);
+    return out << Fixed { data.value, data.decimals };
+}
+
+struct Settings
+{
+    Settings() : cpu(false), memory(false), io(false), network(false), health(false), pressure(false),
+                 pressureText(false), numa(false), throttle(false), daemon(false),
+                 exportPort(-1), parallel(false), stats(false), historyTicks(0), topProcesses(0), frequency(true),
+                 singleLine(false), posRam(0), posTemp(0), netSpeedUnit(Network::Bandwidth::Unit::bit),
+                 netLosses(false), cpuHeatmap(false) {}
+    bool cpu, memory, io, network, health, pressure;
+    bool pressureText; // the worst stall share also in the panel
+    bool numa;         // per node CPU and memory figures
+    bool throttle;     // thermal throttling events and capped cores
+    bool daemon;
+    int exportPort; // OpenMetrics exporter: 0 for the Unix socket, else the localhost TCP port (-1: disabled)
+    bool parallel;  // one thread per source
+    bool stats;     // report the monitor's own cost
+    uint32_t historyTicks; // trends over the latest ticks (0: disabled)
+    uint32_t topProcesses; // heaviest processes listed under CPU and IO (0: disabled)
+    bool frequency; // sample the core clocks for the GHz figures
+    bool singleLine;
+    int posRam;
+    int posTemp;
+    Network::Bandwidth::Unit netSpeedUnit;
+    bool netLosses; // drops and errors of the selected interface also in the panel
+    bool cpuHeatmap; // every core by utilization band instead of the busiest ones
+    std::string selectedNetworkInterface;
+    NameFilter interfaces; // the ones collected
+    std::vector<IO::Name> disks; // read from /sys/block instead of /proc/diskstats (empty: all)
+    std::string cgroup; // a cgroup v2 directory whose figures replace the system wide CPU, RAM, IO and PSI ones
+    std::string arguments; // identifies the daemon serving this configuration
+
+    bool uses(StateId category) const // collects it (as in collect())
     {
-        int32_t tempMilliCelsius;
+        switch (category)
+        {
+            case StateId::CPU: return cpu;
+            case StateId::Memory: return memory;
+            case StateId::IO: return io;
+            case StateId::Network: return network;
+            case StateId::HealthSource: return health;
+            case StateId::Processes: return topProcesses && (cpu || io);
+            case StateId::Pressure: return pressure;
+            case StateId::NumaNodes: return numa;
+            case StateId::ThrottleCores: return throttle;
+            default: return false;
+        }
+    }
+
+    uint64_t variant(StateId category) const // the options changing what a category sample contains
+    {
+        std::string options;
+        if (category == StateId::CPU) options = frequency? "GHz" : "";
+        if (category == StateId::Network) options = interfaces.signature();
+        if (category == StateId::IO) for (const auto& disk : disks) options.append(disk).append(",");
+        if (category == StateId::Processes) options = io? "io" : "";
+        if ((category == StateId::CPU) || (category == StateId::Memory) || (category == StateId::IO)
+            || (category == StateId::Pressure) || (category == StateId::Processes)) options.append("@").append(cgroup);
+        return std::hash<std::string>()(options);
+    }
+};
+
+struct Sample;
+
+class History // per tick figures of the latest ticks, zigzag varint delta encoded (bounded size whatever the uptime)
+{
+public:
+    struct Series
+    {
+        int64_t last;   // newest value (next delta base)
+        uint32_t count;
+        uint32_t bytes; // encoded deltas, oldest first (the first one relative to zero)
+        uint64_t sampledAt; // of the newest value (a sample shared by several instances is recorded once)
     };
 
-    std::map<Name, Thermometer> thermometers;
+    struct Retention // the longest HISTORY= of the instances sharing the state (each one renders its own)
+    {
+        uint64_t ticks;
+        uint64_t requestedAt; // when the instance asking for it last updated the history
+    };
 
-    void readProc()
+    static constexpr uint64_t RETENTION_NSECS = 60 * GB_i; // then a shorter request may trim the series
+
+    History() : retention(Retention { 0, 0 }) {}
+
+    Retention retention;
+    std::map<std::string, Series> series; // "cpu", "net:<interface>", "io:<device>", "temp"
+    std::map<std::string, std::vector<uint8_t>> deltas;
+
+    void update(const Sample& fresh, const Sample& old, const Settings& settings); // (defined after Sample)
+
+    std::vector<int64_t> values(const std::string& name, std::size_t latest) const // oldest first
     {
-        std::string coretemp;
-        for (int hwmon = 0; hwmon < 256; hwmon++)
+        std::vector<int64_t> decoded;
+        auto its = series.find(name);
+        auto itd = deltas.find(name);
+        if ((its == series.end()) || (itd == deltas.end())) return decoded;
+        decoded.reserve(its->second.count);
+        int64_t value = 0;
+        for (std::size_t pos = 0; pos < itd->second.size();) decoded.push_back(value += decode(itd->second, pos));
+        if (decoded.size() > latest) decoded.erase(decoded.begin(), decoded.end() - latest);
+        return decoded;
+    }
+
+    static void encode(std::vector<uint8_t>& bytes, int64_t delta) // zigzag varint (also used by the RECORD log)
+    {
+        uint64_t zigzag = (uint64_t(delta) << 1) ^ uint64_t(delta >> 63);
+        for (; zigzag >= 0x80; zigzag >>= 7) bytes.push_back(uint8_t(zigzag | 0x80));
+        bytes.push_back(uint8_t(zigzag));
+    }
+
+    static int64_t decode(const std::vector<uint8_t>& bytes, std::size_t& pos)
+    {
+        uint64_t zigzag = 0;
+        for (int shift = 0; pos < bytes.size(); shift += 7)
         {
-            std::string base = VA_STR("/sys/class/hwmon/hwmon" << hwmon);
-            std::vector<char> buffer;
-            if (!readFile(VA_STR(base << "/name").c_str(), buffer, false)) // pre-3.15 kernel?
-            {
-                base.append("/device");
-                if (!readFile(VA_STR(base << "/name").c_str(), buffer, false)) break;
-            }
-            std::istringstream sname(&buffer[0]);
-            std::string name;
-            if ((sname >> name) && (name == "coretemp"))
-            {
-                coretemp = base;
-                break;
-            }
+            uint8_t byte = bytes[pos++];
+            zigzag |= uint64_t(byte & 0x7F) << shift;
+            if (!(byte & 0x80)) break;
         }
+        return int64_t(zigzag >> 1) ^ -int64_t(zigzag & 1);
+    }
 
-        if (!coretemp.empty()) for (int ic = 1; ic < 64; ic++)
+private:
+    void record(std::map<std::string, Series>& recorded, std::map<std::string, std::vector<uint8_t>>& encoded,
+                const std::string& name, int64_t value, uint64_t sampledAt)
+    {
+        if (recorded.count(name)) return; // kept as it was
+        auto its = series.find(name);
+        Series& current = recorded[name];
+        std::vector<uint8_t>& bytes = encoded[name];
+        if ((its == series.end()) || !its->second.count) current = Series { 0, 0, 0, 0 };
+        else
         {
-            std::vector<char> buffer;
-            if (!readFile(VA_STR(coretemp << "/temp" << ic << "_label").c_str(), buffer, false))
-            {
-                if (thermometers.empty()) continue; else break; // Atom CPU may start at 2 (!?)
-            }
-            std::istringstream sname(&buffer[0]);
-            std::string name;
-            if (!std::getline(sname, name) || name.empty()) break;
-            if (!readFile(VA_STR(coretemp << "/temp" << ic << "_input").c_str(), buffer, false)) break;
-            std::istringstream temp(&buffer[0]);
-            int32_t tempMilliCelsius;
-            if (!(temp >> tempMilliCelsius)) break;
-            thermometers[name].tempMilliCelsius = tempMilliCelsius;
+            current = its->second;
+            bytes.swap(deltas[name]);
         }
+        encode(bytes, value - current.last);
+        current.last = value;
+        current.sampledAt = sampledAt;
+        for (current.count++; current.count > retention.ticks; current.count--) // drop the oldest, rebase the next one
+        {
+            std::size_t pos = 0;
+            int64_t second = decode(bytes, pos);
+            second += decode(bytes, pos);
+            std::vector<uint8_t> rebased;
+            encode(rebased, second);
+            bytes.erase(bytes.begin(), bytes.begin() + pos);
+            bytes.insert(bytes.begin(), rebased.begin(), rebased.end());
+        }
+        current.bytes = uint32_t(bytes.size());
+    }
+};
+
+struct Diagnostics // rolling window of the latest tick latencies
+{
+    static constexpr std::size_t WINDOW = 100;
+
+    std::vector<uint32_t> latencyUsecs; // oldest first
+
+    void record(uint64_t nsecs)
+    {
+        if (latencyUsecs.size() >= WINDOW) latencyUsecs.erase(latencyUsecs.begin());
+        latencyUsecs.push_back(uint32_t(std::min<uint64_t>(nsecs / 1000, std::numeric_limits<uint32_t>::max())));
+    }
+
+    uint32_t percentile(int percent) const
+    {
+        if (latencyUsecs.empty()) return 0;
+        std::vector<uint32_t> sorted(latencyUsecs);
+        auto nth = sorted.begin() + (sorted.size() - 1) * percent / 100;
+        std::nth_element(sorted.begin(), nth, sorted.end());
+        return *nth;
     }
 };
 
-std::ostream& operator<<(std::ostream& out, const Health::Thermometer& thm)
+struct Sample
 {
-    return out << thm.tempMilliCelsius;
+    Sample() : nowIs(0) {}
+    static double secsBetween(uint64_t freshIs, uint64_t oldIs) { return oldIs? int64_t(freshIs - oldIs) / GB_f : 0; }
+    uint64_t nowIs;
+    std::shared_ptr<CPU>     cpu;
+    std::shared_ptr<Memory>  memory;
+    std::shared_ptr<IO>      io;
+    std::shared_ptr<Network> network;
+    std::shared_ptr<Health>  health;
+    std::shared_ptr<Processes> processes;
+    std::shared_ptr<Pressure> pressure;
+    std::shared_ptr<Numa> numa;
+    std::shared_ptr<Throttle> throttle;
+    std::shared_ptr<Diagnostics> diagnostics;
+    std::shared_ptr<History> history;
+    std::shared_ptr<std::vector<FileRead>> readSet; // files read by the tick (URING batches them in the next one)
+};
+
+void History::update(const Sample& fresh, const Sample& old, const Settings& settings)
+{
+    std::map<std::string, Series> recorded;
+    std::map<std::string, std::vector<uint8_t>> encoded;
+    if ((settings.historyTicks >= retention.ticks) || (fresh.nowIs - retention.requestedAt >= RETENTION_NSECS))
+        retention = Retention { settings.historyTicks, fresh.nowIs };
+    if (!old.nowIs || (fresh.nowIs <= old.nowIs)) return;
+
+    for (const auto& its : series) // unless sampled anew, kept as they are (other instances share the state)
+    {
+        const std::string& name = its.first;
+        const Sampled* category = (name == "cpu")? static_cast<const Sampled*>(fresh.cpu.get())
+                                : !name.compare(0, 4, "net:")? static_cast<const Sampled*>(fresh.network.get())
+                                : !name.compare(0, 3, "io:")? static_cast<const Sampled*>(fresh.io.get())
+                                : static_cast<const Sampled*>(fresh.health.get());
+        if (category && (category->nowIs > its.second.sampledAt)) continue;
+        recorded[name] = its.second;
+        encoded[name] = deltas[name];
+    }
+
+    if (fresh.cpu && old.cpu)
+    {
+        CPU::Core diff = fresh.cpu->all - old.cpu->all;
+        if (diff.cpuTotal() > 0)
+            record(recorded, encoded, "cpu", 10000 * diff.cpuUsed() / diff.cpuTotal(), fresh.cpu->nowIs);
+    }
+    double netSecs = fresh.network && old.network? Sample::secsBetween(fresh.network->nowIs, old.network->nowIs) : 0;
+    if (netSecs > 0) for (const auto& itn : fresh.network->interfaces)
+    {
+        auto ito = old.network->interfaces.find(itn.first);
+        if ((ito == old.network->interfaces.end()) || !itn.second.traffic()) continue;
+        int64_t bytes = itn.second.traffic() - ito->second.traffic();
+        record(recorded, encoded, "net:" + itn.first, int64_t(bytes / netSecs), fresh.network->nowIs);
+    }
+    double ioSecs = fresh.io && old.io? Sample::secsBetween(fresh.io->nowIs, old.io->nowIs) : 0;
+    if (ioSecs > 0) for (const auto& itd : fresh.io->devices)
+    {
+        auto ito = old.io->devices.find(itd.first);
+        if ((ito == old.io->devices.end()) || !(itd.second.bytesRead || itd.second.bytesWritten)) continue;
+        int64_t bytes = itd.second.bytesRead + itd.second.bytesWritten - ito->second.bytesRead
+                      - ito->second.bytesWritten;
+        record(recorded, encoded, "io:" + itd.first, int64_t(bytes / ioSecs), fresh.io->nowIs);
+    }
+    if (fresh.health && !fresh.health->thermometers.empty())
+    {
+        int32_t maxTemp = std::numeric_limits<int32_t>::min();
+        for (const auto& itt : fresh.health->thermometers) maxTemp = std::max(maxTemp, itt.second.tempMilliCelsius);
+        record(recorded, encoded, "temp", maxTemp, fresh.health->nowIs);
+    }
+
+    series.swap(recorded); // series sampled anew but not seen in this tick (e.g. removed interfaces) are dropped
+    deltas.swap(encoded);
 }
 
-std::istream& operator>>(std::istream& in, Health::Thermometer& thm)
+void runCollectors(std::vector<std::function<void()>>& collectors, bool parallel)
 {
-    return in >> thm.tempMilliCelsius;
+    if (!parallel || (collectors.size() < 2))
+    {
+        for (auto& collector : collectors) collector();
+        return;
+    }
+    std::vector<std::thread> workers; // one per source but the first, run by the calling thread
+    for (std::size_t ic = 1; ic < collectors.size(); ic++) workers.push_back(std::thread(collectors[ic]));
+    collectors[0]();
+    for (auto& worker : workers) worker.join();
 }
 
-struct DataSize { uint64_t bytes; };
+template <typename T> T* stamped(T* category, const Settings& settings, StateId id)
+{
+    category->nowIs = monotonicNsecs();
+    category->variant = settings.variant(id);
+    return category;
+}
 
-std::ostream& operator<<(std::ostream& out, const DataSize& data)
+Sample collect(const Settings& settings, const Sample& previous, Sample sample = Sample()) // (sample: reused parts)
 {
-    if (data.bytes <     5000) return out << "0 MB";
-    if (data.bytes <  10*MB_i) return out << std::fixed << std::setprecision(2) << data.bytes / MB_f << " MB";
-    if (data.bytes < 100*MB_i) return out << std::fixed << std::setprecision(1) << data.bytes / MB_f << " MB";
-    if (data.bytes <     GB_i) return out << data.bytes / MB_i << " MB";
-    if (data.bytes <  10*GB_i) return out << std::fixed << std::setprecision(2) << data.bytes / GB_f << " GB";
-    if (data.bytes < 100*GB_i) return out << std::fixed << std::setprecision(1) << data.bytes / GB_f << " GB";
-    if (data.bytes <     TB_i) return out << data.bytes / GB_i << " GB";
-    uint64_t tbx100 = data.bytes / (TB_i / 100);
-    auto decimals = (tbx100 > 9999) || (tbx100 % 100 == 0)? 0 : (tbx100 % 10 == 0)? 1 : 2; // pretty disk sizes
-    return out << std::fixed << std::setprecision(decimals) << data.bytes / TB_f << " TB";
+    sample.nowIs = monotonicNsecs();
+    std::vector<std::function<void()>> collectors; // each one only touches its own part of the sample
+    if (settings.cpu && !sample.cpu) collectors.push_back([&]()
+    {
+        Probe probe(Timings::CPU_READ);
+        sample.cpu.reset(stamped(new CPU(), settings, StateId::CPU));
+        if (settings.cgroup.empty()) sample.cpu->readProc(settings.frequency);
+        else sample.cpu->readCgroup(settings.cgroup, sample.cpu->nowIs);
+    });
+    if (settings.memory && !sample.memory) collectors.push_back([&]()
+    {
+        Probe probe(Timings::MEMORY_READ);
+        sample.memory.reset(stamped(new Memory(), settings, StateId::Memory));
+        if (settings.cgroup.empty()) sample.memory->readProc();
+        else sample.memory->readCgroup(settings.cgroup);
+    });
+    if (settings.io && !sample.io) collectors.push_back([&]()
+    {
+        Probe probe(Timings::IO_READ);
+        sample.io.reset(stamped(new IO(), settings, StateId::IO));
+        sample.io->readProc(previous.io.get(), sample.io->nowIs, settings.disks, settings.cgroup);
+    });
+    if (settings.network && !sample.network) collectors.push_back([&]()
+    {
+        Probe probe(Timings::NETWORK_READ);
+        sample.network.reset(stamped(new Network(), settings, StateId::Network));
+        sample.network->readProc(settings.interfaces);
+    });
+    if (settings.health && !sample.health) collectors.push_back([&]()
+    {
+        Probe probe(Timings::HEALTH_READ);
+        sample.health.reset(stamped(new Health(), settings, StateId::HealthSource));
+        sample.health->readProc(previous.health.get(), sample.health->nowIs);
+    });
+    if (settings.topProcesses && (settings.cpu || settings.io) && !sample.processes) collectors.push_back([&]()
+    {
+        Probe probe(Timings::PROCESSES_READ);
+        sample.processes.reset(stamped(new Processes(), settings, StateId::Processes));
+        sample.processes->readProc(settings.io, settings.cgroup);
+    });
+    if (settings.pressure && !sample.pressure) collectors.push_back([&]()
+    {
+        Probe probe(Timings::PRESSURE_READ);
+        sample.pressure.reset(stamped(new Pressure(), settings, StateId::Pressure));
+        sample.pressure->readProc(settings.cgroup);
+    });
+    if (settings.numa && !sample.numa) collectors.push_back([&]()
+    {
+        Probe probe(Timings::NUMA_READ);
+        sample.numa.reset(stamped(new Numa(), settings, StateId::NumaNodes));
+        sample.numa->readProc(previous.numa.get(), sample.numa->nowIs);
+    });
+    if (settings.throttle && !sample.throttle) collectors.push_back([&]()
+    {
+        Probe probe(Timings::THROTTLE_READ);
+        sample.throttle.reset(stamped(new Throttle(), settings, StateId::ThrottleCores));
+        sample.throttle->readProc(previous.throttle.get(), sample.throttle->nowIs);
+    });
+    if (batchReads && previous.readSet)
+    {
+        Probe probe(Timings::BATCH_READ);
+        readAhead(*previous.readSet);
+    }
+    runCollectors(collectors, settings.parallel);
+    if (batchReads)
+    {
+        std::lock_guard<std::mutex> lock(filesLock);
+        sample.readSet.reset(new std::vector<FileRead>());
+        sample.readSet->swap(filesRead);
+        prefetched.clear(); // not used this time
+    }
+    if (settings.stats)
+        sample.diagnostics.reset(previous.diagnostics? new Diagnostics(*previous.diagnostics) : new Diagnostics());
+    if (settings.historyTicks)
+    {
+        sample.history.reset(previous.history? new History(*previous.history) : new History());
+        sample.history->update(sample, previous, settings);
+    }
+    return sample;
+}
+
+// Another instance (other arguments, same state file) may have just sampled a category: its sample is reused when
+// taken with the same options, recently and late enough in its own interval (which becomes the reported one)
+const uint64_t REUSE_NSECS = 500 * MB_i;
+
+template <typename T> void reuseShared(const Settings& settings, StateId id, bool deltas, uint64_t nowIs,
+                                       std::shared_ptr<T>& reused, std::shared_ptr<T>& old,
+                                       const std::shared_ptr<T>& older)
+{
+    if (!old || (old->variant != settings.variant(id)) || (nowIs - old->nowIs >= REUSE_NSECS)) return;
+    if (deltas && (!older || (older->nowIs >= old->nowIs) || (2 * (nowIs - old->nowIs) >= old->nowIs - older->nowIs)))
+        return;
+    reused = old;
+    old = older; // what the reused sample is compared against
+}
+
+Sample collectShared(const Settings& settings, Sample& old, const Sample& older)
+{
+    Sample reused;
+    uint64_t nowIs = monotonicNsecs();
+    if (settings.cpu) reuseShared(settings, StateId::CPU, true, nowIs, reused.cpu, old.cpu, older.cpu);
+    if (settings.memory) reuseShared(settings, StateId::Memory, false, nowIs, reused.memory, old.memory, older.memory);
+    if (settings.io) reuseShared(settings, StateId::IO, true, nowIs, reused.io, old.io, older.io);
+    if (settings.network)
+        reuseShared(settings, StateId::Network, true, nowIs, reused.network, old.network, older.network);
+    if (settings.health)
+        reuseShared(settings, StateId::HealthSource, false, nowIs, reused.health, old.health, older.health);
+    if (settings.topProcesses)
+        reuseShared(settings, StateId::Processes, true, nowIs, reused.processes, old.processes, older.processes);
+    if (settings.pressure)
+        reuseShared(settings, StateId::Pressure, true, nowIs, reused.pressure, old.pressure, older.pressure);
+    if (settings.numa) reuseShared(settings, StateId::NumaNodes, true, nowIs, reused.numa, old.numa, older.numa);
+    if (settings.throttle)
+        reuseShared(settings, StateId::ThrottleCores, true, nowIs, reused.throttle, old.throttle, older.throttle);
+    return collect(settings, old, reused);
 }
 
-template <typename T> struct Padded { uint64_t max; T value; };
+std::string runtimeFile(int locTry, const char* suffix)
+{
+    std::string uid = std::to_string(getuid());
+    if (locTry == 0) return sourceRoot + "/run/user/" + uid + "/xfce-hkmon" + suffix;
+    return sourceRoot + "/tmp/xfce-hkmon." + uid + suffix;
+}
+
+void openState(StateFile& stateFile, const char* suffix = ".state") // locked until closed
+{
+    for (int locTry = 0; !stateFile.open(runtimeFile(locTry, suffix).c_str(), true); locTry++)
+        if (locTry > 0) abortApp("can't write tmpfile");
+}
 
-template <typename T> std::ostream& operator<<(std::ostream& out, const Padded<T>& data)
+void packCategories(StateImage& state, const Sample& sample, uint32_t slot,
+                    std::map<int32_t, Sampled> sampled = std::map<int32_t, Sampled>()) // (by category StateId)
 {
-    if (!std::isnan(data.value)) for (T div = data.max;; div /= 10) // avoid infinite loop with NaN numbers
+    if (sample.cpu)
     {
-        if ((data.value >= div) && (data.value >= 1)) break;
-        if ((data.value < 1) && (div <= 1)) break;
-        out << "  "; // two spaces in place of each missing digit (same width in XFCE Generic Monitor applet)
+        sample.cpu->pack(state, slot);
+        sampled[int32_t(StateId::CPU)] = *sample.cpu;
     }
-    return out << data.value;
+    if (sample.memory)
+    {
+        state.addRecord(StateId::Memory + slot, sample.memory->ram);
+        sampled[int32_t(StateId::Memory)] = *sample.memory;
+    }
+    if (sample.io)
+    {
+        state.add(StateId::IO + slot, sample.io->devices);
+        state.add(StateId::IOBlocks + slot, sample.io->blocks);
+        state.addRecord(StateId::IOScan + slot, sample.io->scannedAt);
+        sampled[int32_t(StateId::IO)] = *sample.io;
+    }
+    if (sample.network)
+    {
+        state.add(StateId::Network + slot, sample.network->interfaces);
+        sampled[int32_t(StateId::Network)] = *sample.network;
+    }
+    if (sample.health)
+    {
+        state.addRecord(StateId::HealthSource + slot, sample.health->source);
+        state.add(StateId::HealthLabels + slot, sample.health->labels);
+        state.add(StateId::HealthTemps + slot, sample.health->thermometers);
+        sampled[int32_t(StateId::HealthSource)] = *sample.health;
+    }
+    if (sample.processes)
+    {
+        state.addArray(StateId::Processes + slot, sample.processes->tasks);
+        sampled[int32_t(StateId::Processes)] = *sample.processes;
+    }
+    if (sample.pressure)
+    {
+        std::vector<Pressure::Stall> stalls(sample.pressure->some); // some, then full
+        stalls.insert(stalls.end(), sample.pressure->full.begin(), sample.pressure->full.end());
+        state.addArray(StateId::Pressure + slot, stalls);
+        sampled[int32_t(StateId::Pressure)] = *sample.pressure;
+    }
+    if (sample.numa)
+    {
+        state.add(StateId::NumaNodes + slot, sample.numa->nodes);
+        state.addArray(StateId::NumaCores + slot, sample.numa->nodeOfCore);
+        state.addRecord(StateId::NumaScan + slot, sample.numa->scannedAt);
+        sampled[int32_t(StateId::NumaNodes)] = *sample.numa;
+    }
+    if (sample.throttle)
+    {
+        state.addArray(StateId::ThrottleCores + slot, sample.throttle->cores);
+        state.addRecord(StateId::ThrottleScan + slot, sample.throttle->scannedAt);
+        sampled[int32_t(StateId::ThrottleCores)] = *sample.throttle;
+    }
+    state.add(StateId::SampledAt + slot, sampled);
 }
 
-int main(int argc, char** argv)
+Sample unpackCategories(const StateImage& state, uint32_t slot, const Settings* settings = nullptr) // (all if none)
 {
-    if (argc < 2)
+    Sample sample;
+    sample.nowIs = state.nowIs();
+    std::map<int32_t, Sampled> sampled;
+    state.get(StateId::SampledAt + slot, sampled);
+    auto stamp = [&](StateId id, Sampled& category)
     {
-         std::cerr << "usage: " << argv[0] << " [NET|<network_interface>] [CPU] [TEMP] [IO] [RAM]" << std::endl;
-         return 1;
+        auto its = sampled.find(int32_t(id));
+        if (its != sampled.end()) category = its->second;
+        else category.nowIs = sample.nowIs;
+    };
+    auto wanted = [&](StateId id) { return !settings || settings->uses(id); };
+    if (wanted(StateId::CPU))
+    {
+        sample.cpu.reset(new CPU());
+        if (!sample.cpu->unpack(state, slot)) sample.cpu.reset();
+        else stamp(StateId::CPU, *sample.cpu);
     }
-
-    std::shared_ptr<CPU>     new_CPU, old_CPU;
-    std::shared_ptr<Memory>  new_Memory;
-    std::shared_ptr<IO>      new_IO, old_IO;
-    std::shared_ptr<Network> new_Network, old_Network;
-    Network::Bandwidth::Unit netSpeedUnit = Network::Bandwidth::Unit::bit;
-    std::shared_ptr<Health>  new_Health;
-    std::string selectedNetworkInterface;
-
-    bool singleLine = false;
-    int posRam = 0;
-    int posTemp = 0;
-    for (int i = 1; i < argc; i++)
+    if (wanted(StateId::Memory))
     {
-        std::string arg(argv[i]);
-        if      ((arg == "LINE")) singleLine = true;
-        else if ((arg == "CPU"))  new_CPU.reset(new CPU());
-        else if ((arg == "RAM"))  posRam = i, new_Memory.reset(new Memory());
-        else if ((arg == "IO"))   new_IO.reset(new IO());
-        else if ((arg == "NET"))  new_Network.reset(new Network());
-        else if ((arg == "NET8")) new_Network.reset(new Network()), netSpeedUnit = Network::Bandwidth::Unit::byte;
-        else if ((arg == "TEMP")) posTemp = i, new_Health.reset(new Health());
+        sample.memory.reset(new Memory());
+        if (!state.getRecord(StateId::Memory + slot, sample.memory->ram)) sample.memory.reset();
+        else stamp(StateId::Memory, *sample.memory);
+    }
+    if (wanted(StateId::IO))
+    {
+        sample.io.reset(new IO());
+        if (!state.get(StateId::IO + slot, sample.io->devices)) sample.io.reset();
         else
         {
-            new_Network.reset(new Network());
-            selectedNetworkInterface = argv[i];
+            if (!state.get(StateId::IOBlocks + slot, sample.io->blocks)
+                || !state.getRecord(StateId::IOScan + slot, sample.io->scannedAt)) sample.io->blocks.clear();
+            stamp(StateId::IO, *sample.io);
         }
     }
-
-    timespec tp;
-    if (clock_gettime(CLOCK_MONOTONIC, &tp) != 0) abortApp("clock_gettime");
-    uint64_t nowIs = tp.tv_sec * GB_i + tp.tv_nsec;
-    int64_t nsecsElapsed = 0;
-
-    std::ostringstream newState;
-    newState << APP_VERSION << " " << nowIs << "\n";
-    if (new_CPU)     { new_CPU->readProc();     newState << "CPU|"     << new_CPU->cores;          }
-    if (new_Memory)  { new_Memory->readProc();                                                     }
-    if (new_IO)      { new_IO->readProc();      newState << "IO|"      << new_IO->devices;         }
-    if (new_Network) { new_Network->readProc(); newState << "Network|" << new_Network->interfaces; }
-    if (new_Health)  { new_Health->readProc();                                                     }
-
-    for (int locTry = 0;; locTry++) // read the previous state from disk and store the new state
-    {
-        std::vector<char> oldStateData;
-        std::ostringstream stateFileName;
-
-        if (locTry == 0)
-            stateFileName << "/run/user/" << getuid() << "/xfce-hkmon.dat";
-        else if (locTry == 1)
-            stateFileName << "/tmp/xfce-hkmon." << getuid() << ".dat";
+    if (wanted(StateId::Network))
+    {
+        sample.network.reset(new Network());
+        if (!state.get(StateId::Network + slot, sample.network->interfaces)) sample.network.reset();
+        else stamp(StateId::Network, *sample.network);
+    }
+    if (wanted(StateId::HealthSource))
+    {
+        sample.health.reset(new Health());
+        if (!state.getRecord(StateId::HealthSource + slot, sample.health->source)
+            || !state.get(StateId::HealthLabels + slot, sample.health->labels)) sample.health.reset();
         else
-            abortApp("can't write tmpfile");
+        {
+            state.get(StateId::HealthTemps + slot, sample.health->thermometers);
+            stamp(StateId::HealthSource, *sample.health);
+        }
+    }
+    if (wanted(StateId::Processes))
+    {
+        sample.processes.reset(new Processes());
+        if (!state.getArray(StateId::Processes + slot, sample.processes->tasks)) sample.processes.reset();
+        else stamp(StateId::Processes, *sample.processes);
+    }
+    std::vector<Pressure::Stall> stalls;
+    if (wanted(StateId::Pressure) && state.getArray(StateId::Pressure + slot, stalls)
+        && (stalls.size() == 2 * Pressure::RESOURCES))
+    {
+        sample.pressure.reset(new Pressure());
+        sample.pressure->some.assign(stalls.begin(), stalls.begin() + Pressure::RESOURCES);
+        sample.pressure->full.assign(stalls.begin() + Pressure::RESOURCES, stalls.end());
+        stamp(StateId::Pressure, *sample.pressure);
+    }
+    if (wanted(StateId::NumaNodes))
+    {
+        sample.numa.reset(new Numa());
+        if (!state.get(StateId::NumaNodes + slot, sample.numa->nodes)
+            || !state.getArray(StateId::NumaCores + slot, sample.numa->nodeOfCore)
+            || !state.getRecord(StateId::NumaScan + slot, sample.numa->scannedAt)) sample.numa.reset();
+        else stamp(StateId::NumaNodes, *sample.numa);
+    }
+    if (wanted(StateId::ThrottleCores))
+    {
+        sample.throttle.reset(new Throttle());
+        if (!state.getArray(StateId::ThrottleCores + slot, sample.throttle->cores)
+            || !state.getRecord(StateId::ThrottleScan + slot, sample.throttle->scannedAt)) sample.throttle.reset();
+        else stamp(StateId::ThrottleCores, *sample.throttle);
+    }
+    return sample;
+}
 
-        if (readFile(stateFileName.str().c_str(), oldStateData, false))
+struct StoredState // every pair found by loadState(), for storeState() to merge the fresh one into
+{
+    StateImage image; // the categories not used by this instance are copied through from it, not decoded
+    std::vector<Sample> current, previous; // by pair (each category has its variants in the first ones)
+    std::vector<std::pair<uint64_t, std::vector<char>>> readSets; // by hash of the instance arguments
+};
+
+template <typename T> void pickVariant(std::shared_ptr<T> Sample::* category, uint64_t variant,
+                                       const StoredState& stored, Sample& old, Sample& older)
+{
+    for (std::size_t pair = 0; pair < stored.current.size(); pair++)
+        if ((stored.current[pair].*category) && ((stored.current[pair].*category)->variant == variant))
+        {
+            old.*category = stored.current[pair].*category;
+            older.*category = stored.previous[pair].*category;
+            return;
+        }
+}
+
+// The stored sample and the one before it taken with the current settings (empty if unavailable)
+Sample loadState(StateFile& stateFile, const Settings& settings, Sample& older, StoredState& stored)
+{
+    Probe probe(Timings::STATE_LOAD);
+    Sample old;
+    std::vector<char> oldStateData;
+    stateFile.read(oldStateData);
+    stored.image = StateImage(oldStateData);
+    const StateImage& oldState = stored.image;
+    if (oldState.valid())
+    {
+        for (uint32_t pair = 0; pair < VARIANT_SLOTS; pair++)
+        {
+            stored.current.push_back(unpackCategories(oldState, slotOf(pair, false), &settings));
+            stored.previous.push_back(unpackCategories(oldState, slotOf(pair, true), &settings));
+        }
+        old.nowIs = older.nowIs = oldState.nowIs();
+        pickVariant(&Sample::cpu, settings.variant(StateId::CPU), stored, old, older);
+        pickVariant(&Sample::memory, settings.variant(StateId::Memory), stored, old, older);
+        pickVariant(&Sample::io, settings.variant(StateId::IO), stored, old, older);
+        pickVariant(&Sample::network, settings.variant(StateId::Network), stored, old, older);
+        pickVariant(&Sample::health, settings.variant(StateId::HealthSource), stored, old, older);
+        pickVariant(&Sample::processes, settings.variant(StateId::Processes), stored, old, older);
+        pickVariant(&Sample::pressure, settings.variant(StateId::Pressure), stored, old, older);
+        pickVariant(&Sample::numa, settings.variant(StateId::NumaNodes), stored, old, older);
+        pickVariant(&Sample::throttle, settings.variant(StateId::ThrottleCores), stored, old, older);
+
+        std::vector<uint64_t> owners;
+        oldState.getArray(StateId::ReadSetOwners, owners);
+        for (uint32_t owner = 0; (owner < owners.size()) && (owner < VARIANT_SLOTS); owner++)
         {
-            std::istringstream oldState(&oldStateData[0]);
-            std::string version;
-            uint64_t previouslyWas;
-            oldState >> version >> previouslyWas;
-            nsecsElapsed = nowIs - previouslyWas;
-            oldState.ignore(oldStateData.size(), '\n');
-            if (version == APP_VERSION)
+            std::vector<char> readSet; // "<path>\t<length>" lines
+            if (!oldState.getArray(StateId::ReadSet + owner * VARIANT_STRIDE, readSet)) continue;
+            if (owners[owner] == std::hash<std::string>()(settings.arguments))
             {
-                std::string category;
-                while (std::getline(oldState, category, '|'))
+                old.readSet.reset(new std::vector<FileRead>());
+                for (Scanner files(readSet); !files.atEnd(); files.nextLine())
                 {
-                    if      (category == "CPU")     { old_CPU.reset(new CPU()); oldState >> old_CPU->cores;  }
-                    else if (category == "IO")      { old_IO.reset(new IO());   oldState >> old_IO->devices; }
-                    else if (category == "Network")
-                    {
-                        old_Network.reset(new Network()); oldState >> old_Network->interfaces;
-                    }
-                    else oldState.ignore(oldStateData.size(), '\n');
+                    FileRead file = { files.until('\t').str(), 0 };
+                    if (files.number(file.length)) old.readSet->push_back(file);
                 }
             }
+            stored.readSets.push_back(std::make_pair(owners[owner], std::move(readSet)));
+        }
+        old.diagnostics.reset(new Diagnostics());
+        if (!oldState.getArray(StateId::Latency, old.diagnostics->latencyUsecs)) old.diagnostics.reset();
+        old.history.reset(new History());
+        std::vector<uint8_t> deltas;
+        if (oldState.get(StateId::HistorySeries, old.history->series)
+            && oldState.getArray(StateId::HistoryDeltas, deltas))
+        {
+            std::size_t offset = 0;
+            for (const auto& its : old.history->series)
+            {
+                if (offset + its.second.bytes > deltas.size()) break;
+                old.history->deltas[its.first].assign(&deltas[offset], &deltas[offset] + its.second.bytes);
+                offset += its.second.bytes;
+            }
+            if (old.history->deltas.size() != old.history->series.size()) old.history.reset();
+            else oldState.getRecord(StateId::HistoryRetention, old.history->retention);
+        }
+        else old.history.reset();
+    }
+    return old;
+}
+
+// The fresh pair replaces the stored one of its variant and goes first; the pairs of other variants follow
+template <typename T> void mergeVariants(std::shared_ptr<T> Sample::* category, const Sample& fresh, const Sample& old,
+                                         const StoredState& stored, StoredState& merged)
+{
+    std::size_t pairs = 0;
+    if (fresh.*category)
+    {
+        merged.current[pairs].*category = fresh.*category;
+        merged.previous[pairs++].*category = old.*category;
+    }
+    for (std::size_t pair = 0; (pair < stored.current.size()) && (pairs < VARIANT_SLOTS); pair++)
+    {
+        const std::shared_ptr<T>& was = stored.current[pair].*category;
+        if (!was || ((fresh.*category) && ((fresh.*category)->variant == was->variant))) continue;
+        merged.current[pairs].*category = was;
+        merged.previous[pairs++].*category = stored.previous[pair].*category;
+    }
+}
+
+// Merged per category and variant: instances started with different arguments do not clobber each other's samples
+void storeState(StateFile& stateFile, const Settings& settings, const Sample& fresh, const Sample& old,
+                const StoredState& stored)
+{
+    Probe probe(Timings::STATE_STORE);
+    StoredState merged;
+    merged.current.resize(VARIANT_SLOTS);
+    merged.previous.resize(VARIANT_SLOTS);
+    mergeVariants(&Sample::cpu, fresh, old, stored, merged);
+    mergeVariants(&Sample::memory, fresh, old, stored, merged);
+    mergeVariants(&Sample::io, fresh, old, stored, merged);
+    mergeVariants(&Sample::network, fresh, old, stored, merged);
+    mergeVariants(&Sample::health, fresh, old, stored, merged);
+    mergeVariants(&Sample::processes, fresh, old, stored, merged);
+    mergeVariants(&Sample::pressure, fresh, old, stored, merged);
+    mergeVariants(&Sample::numa, fresh, old, stored, merged);
+    mergeVariants(&Sample::throttle, fresh, old, stored, merged);
+    std::shared_ptr<Diagnostics> diagnostics = fresh.diagnostics? fresh.diagnostics : old.diagnostics;
+    std::shared_ptr<History> history = fresh.history? fresh.history : old.history;
+
+    StateImage newState;
+    bool carried = stored.image.valid();
+    std::vector<StateSection> table;
+    if (carried) table = stored.image.table();
+    for (uint32_t slot = 0; slot < VARIANT_SLOTS * VARIANT_STRIDE; slot += PREVIOUS_SLOT)
+    {
+        std::map<int32_t, Sampled> sampled; // of the categories carried in this slot
+        if (carried && stored.image.get(StateId::SampledAt + slot, sampled))
+            for (auto its = sampled.begin(); its != sampled.end();)
+                its = settings.uses(StateId(its->first))? sampled.erase(its) : ++its;
+        uint32_t pair = slot / VARIANT_STRIDE;
+        packCategories(newState, (slot % VARIANT_STRIDE)? merged.previous[pair] : merged.current[pair], slot, sampled);
+    }
+    for (const auto& section : table)
+    {
+        StateId category = categoryOf(section.id);
+        if ((uint32_t(category) != 0) && !settings.uses(category)) newState.addRaw(stored.image, section);
+    }
+    if (diagnostics) newState.addArray(StateId::Latency, diagnostics->latencyUsecs);
+
+    std::vector<uint64_t> owners;
+    if (fresh.readSet) // the own one first
+    {
+        std::vector<char> readSet;
+        for (const auto& file : *fresh.readSet)
+        {
+            std::string line = file.path + "\t" + std::to_string(file.length) + "\n";
+            readSet.insert(readSet.end(), line.begin(), line.end());
+        }
+        owners.push_back(std::hash<std::string>()(settings.arguments));
+        newState.addArray(StateId::ReadSet, readSet);
+    }
+    for (const auto& itr : stored.readSets)
+        if ((owners.size() < VARIANT_SLOTS) && (!fresh.readSet || (itr.first != owners.front())))
+        {
+            newState.addArray(StateId::ReadSet + uint32_t(owners.size()) * VARIANT_STRIDE, itr.second);
+            owners.push_back(itr.first);
         }
+    if (!owners.empty()) newState.addArray(StateId::ReadSetOwners, owners);
 
-        if (writeFile(stateFileName.str().c_str(), newState)) break;
+    if (history)
+    {
+        std::vector<uint8_t> deltas; // concatenated in the series order
+        for (const auto& itd : history->deltas)
+            deltas.insert(deltas.end(), itd.second.begin(), itd.second.end());
+        newState.add(StateId::HistorySeries, history->series);
+        newState.addArray(StateId::HistoryDeltas, deltas);
+        newState.addRecord(StateId::HistoryRetention, history->retention);
     }
+    if (!stateFile.write(newState.build(fresh.nowIs))) abortApp("can't write tmpfile");
+}
 
-    std::ostringstream reportStd, reportDetail;
-    double secsElapsed = nsecsElapsed / GB_f;
+void render(const Settings& settings, const Sample& fresh, const Sample& old,
+            Output& reportStd, Output& reportDetail)
+{
+    std::string selectedNetworkInterface = settings.selectedNetworkInterface;
+    double netSecs = fresh.network && old.network? Sample::secsBetween(fresh.network->nowIs, old.network->nowIs) : 0;
+    double ioSecs = fresh.io && old.io? Sample::secsBetween(fresh.io->nowIs, old.io->nowIs) : 0;
+
+    if (!settings.cgroup.empty())
+    {
+        std::string scope = settings.cgroup.substr(strlen("/sys/fs/cgroup"));
+        reportDetail << " cgroup " << (scope.empty()? "/" : scope) << ":\n";
+    }
 
-    if (new_Network && old_Network && nsecsElapsed) // NET report
+    if (netSecs > 0) // NET report
     {
         if (selectedNetworkInterface.empty())
         {
             int64_t maxBandwidth = -1;
             uint64_t selectedTraffic = 0;
-            for (auto itn = new_Network->interfaces.cbegin(); itn != new_Network->interfaces.cend(); ++itn)
+            for (auto itn = fresh.network->interfaces.cbegin(); itn != fresh.network->interfaces.cend(); ++itn)
             {
                 if (itn->first == "lo") continue;
-                auto ito = old_Network->interfaces.find(itn->first);
-                if (ito == old_Network->interfaces.end()) continue;
+                auto ito = old.network->interfaces.find(itn->first);
+                if (ito == old.network->interfaces.end()) continue;
                 int64_t transferred = itn->second.bytesRecv - ito->second.bytesRecv;
                 transferred += itn->second.bytesSent - ito->second.bytesSent;
                 if (transferred < maxBandwidth) continue;
@@ -606,61 +2993,96 @@ int main(int argc, char** argv)
             }
         }
 
-        for (auto itn = new_Network->interfaces.cbegin(); itn != new_Network->interfaces.cend(); ++itn)
+        for (auto itn = fresh.network->interfaces.cbegin(); itn != fresh.network->interfaces.cend(); ++itn)
         {
-            auto ito = old_Network->interfaces.find(itn->first);
-            if (ito == old_Network->interfaces.end()) continue;
+            auto ito = old.network->interfaces.find(itn->first);
+            if (ito == old.network->interfaces.end()) continue;
             const Network::Interface& nif = itn->second;
             const Network::Interface& oif = ito->second;
             bool isSelectedInterface = itn->first == selectedNetworkInterface;
             if (!nif.traffic() && !isSelectedInterface) continue;
 
-            auto dumpNet = [&](const char* iconIdle, const char* iconBusy, uint64_t newBytes, uint64_t oldBytes)
+            double lossRate = (nif.losses() - std::min(nif.losses(), oif.losses())) / netSecs;
+            auto dumpNet = [&](const char* iconIdle, const char* iconBusy, uint64_t newBytes, uint64_t oldBytes,
+                               bool receiving)
             {
                 int64_t delta = newBytes - oldBytes;
-                int64_t speed = (netSpeedUnit == Network::Bandwidth::Unit::byte? 1 : 8) * delta / secsElapsed;
+                int64_t speed = (settings.netSpeedUnit == Network::Bandwidth::Unit::byte? 1 : 8) * delta / netSecs;
                 const char* icon = delta? iconBusy : iconIdle;
                 reportDetail << "    " << icon << "  " << DataSize { newBytes };
-                if (speed > 0) reportDetail << " - " << Network::Bandwidth { netSpeedUnit, speed };
+                if (speed > 0) reportDetail << " - " << Network::Bandwidth { settings.netSpeedUnit, speed };
                 reportDetail << " \n";
                 if (isSelectedInterface)
-                    reportStd << std::setw(6) << Network::Bandwidth { netSpeedUnit, speed } << " " << icon
-                              << (singleLine? " " : " \n");
+                {
+                    reportStd.width(6) << Network::Bandwidth { settings.netSpeedUnit, speed } << " " << icon;
+                    if (settings.netLosses && (lossRate > 0) && receiving)
+                        reportStd << " \u26A0" << Fixed { lossRate, lossRate < 10? 1 : 0 } << "/s";
+                    reportStd << (settings.singleLine? " " : " \n");
+                }
             };
 
             reportDetail << " " << itn->first << ": ";
             if (isSelectedInterface) reportDetail << "\u2713"; // "check mark" character
             reportDetail << "\n";
-            dumpNet("\u25B3", "\u25B2", nif.bytesSent, oif.bytesSent); // white/black up pointing triangles
-            dumpNet("\u25BD", "\u25BC", nif.bytesRecv, oif.bytesRecv); // down pointing triangles
+            dumpNet("\u25B3", "\u25B2", nif.bytesSent, oif.bytesSent, false); // white/black up pointing triangles
+            dumpNet("\u25BD", "\u25BC", nif.bytesRecv, oif.bytesRecv, true);  // down pointing triangles
+
+            auto rate = [&](uint64_t now, uint64_t was) { return (now - std::min(now, was)) / netSecs; };
+            double sent = rate(nif.packetsSent, oif.packetsSent), recv = rate(nif.packetsRecv, oif.packetsRecv);
+            if ((sent > 0) || (recv > 0) || (lossRate > 0))
+            {
+                reportDetail << "    " << int64_t(sent + 0.5) << "|" << int64_t(recv + 0.5) << " pkt/s";
+                double drops = rate(nif.dropsSent, oif.dropsSent) + rate(nif.dropsRecv, oif.dropsRecv);
+                double errors = rate(nif.errorsSent, oif.errorsSent) + rate(nif.errorsRecv, oif.errorsRecv);
+                if (drops > 0) reportDetail << ", " << Fixed { drops, 1 } << " drops/s";
+                if (errors > 0) reportDetail << ", " << Fixed { errors, 1 } << " errors/s";
+                reportDetail << " \n";
+            }
         }
     }
 
-    if (new_CPU && old_CPU) // CPU report
+    if (fresh.cpu && old.cpu) // CPU report
     {
-        struct CpuStat { CPU::Number number; double percent; double ghz; };
-        std::multimap<double, CpuStat> rankByGhzUsage;
+        struct CpuStat { double rank; CPU::Number number; double percent; double ghz; };
+        std::vector<CpuStat> rankByGhzUsage;
+        std::vector<int64_t> used, total;
+        fresh.cpu->deltas(*old.cpu, used, total);
+        static const char* blocks[] = { "\u2581", "\u2582", "\u2583", "\u2584",   // eighths of utilization
+                                        "\u2585", "\u2586", "\u2587", "\u2588" };
+        std::size_t bands[8] = { };
+        std::string heatmap; // one block per core, or a dot operator if offline (all 3-byte UTF-8)
+        if (settings.cpuHeatmap) heatmap.reserve(used.size() * 3);
+        else rankByGhzUsage.reserve(used.size());
         double cum_weighted_ghz = 0;
-        for (auto itn = new_CPU->cores.cbegin(); itn != new_CPU->cores.cend(); ++itn)
-        {
-            if (itn->first < 0) continue;
-            auto ito = old_CPU->cores.find(itn->first);
-            if (ito == old_CPU->cores.end()) continue;
-            CPU::Core diff = itn->second - ito->second;
-            if (diff.cpuTotal() == 0) continue;
-            double unityUsage = 1.0 * diff.cpuUsed() / diff.cpuTotal();
-            double ghz = diff.freq_hz / GB_f;
+        for (std::size_t number = 0; number < used.size(); number++)
+        {
+            if (total[number] == 0)
+            {
+                if (settings.cpuHeatmap) heatmap += "\u22C5";
+                continue;
+            }
+            double unityUsage = 1.0 * used[number] / total[number];
+            double ghz = (fresh.cpu->freq_hz[number] + old.cpu->freq_hz[number]) / 2 / GB_f;
             double ghzUsage = ghz * unityUsage;
             cum_weighted_ghz += ghzUsage;
-            rankByGhzUsage.insert({ ghzUsage, CpuStat { itn->first, 100.0 * unityUsage, ghz } });
+            if (settings.cpuHeatmap)
+            {
+                int band = std::max(0, std::min(7, int(unityUsage * 8)));
+                bands[band]++;
+                heatmap += blocks[band];
+            }
+            else rankByGhzUsage.push_back(CpuStat { settings.frequency? ghzUsage : unityUsage,
+                                                    CPU::Number(number), 100.0 * unityUsage, ghz });
         }
+        auto topCpu = rankByGhzUsage.begin() + std::min<std::size_t>(8, rankByGhzUsage.size());
+        std::partial_sort(rankByGhzUsage.begin(), topCpu, rankByGhzUsage.end(),
+                          [](const CpuStat& a, const CpuStat& b) { return a.rank > b.rank; });
+        rankByGhzUsage.erase(topCpu, rankByGhzUsage.end());
 
-        auto allnew = new_CPU->cores.find(-1);
-        auto allold = old_CPU->cores.find(-1);
-        if ((allnew != new_CPU->cores.end()) && (allold != old_CPU->cores.end()))
+        if (fresh.cpu->all.cpuTotal() && old.cpu->all.cpuTotal())
         {
-            const CPU::Core& ncpu = allnew->second;
-            const CPU::Core& ocpu = allold->second;
+            const CPU::Core& ncpu = fresh.cpu->all;
+            const CPU::Core& ocpu = old.cpu->all;
             CPU::Core diff = ncpu - ocpu;
             auto cpuTotal = diff.cpuTotal();
             if (cpuTotal > 0)
@@ -670,18 +3092,20 @@ int main(int argc, char** argv)
 
                 auto dumpPercent = [&](const char* title, int64_t user_hz, int64_t user_hz__sinceBoot)
                 {
-                    reportDetail << "   " << Padded<double> { 100, 100.0 * user_hz / cpuTotal } << "% " << title
-                                 << "  (" << 100.0 * user_hz__sinceBoot / cpuTotalSinceBoot << "%) \n";
+                    reportDetail << "   " << Padded<double> { 100, 100.0 * user_hz / cpuTotal, 2 } << "% " << title
+                                 << "  (" << Fixed { 100.0 * user_hz__sinceBoot / cpuTotalSinceBoot, 2 } << "%) \n";
                 };
 
-                reportStd << std::setw(6) << std::fixed << std::setprecision(1) << usagePercent << "%";
+                reportStd.width(6) << Fixed { usagePercent, 1 } << "%";
 
-                reportDetail << " CPU \u2699 " << std::fixed << std::setprecision(2) << usagePercent << "% \u2248 ";
+                reportDetail << " CPU \u2699 " << Fixed { usagePercent, 2 } << "%";
 
-                if (cum_weighted_ghz < 1)
-                    reportDetail << uint64_t(cum_weighted_ghz * 1000) << " MHz:\n" << std::setprecision(2);
+                if (!settings.frequency)
+                    reportDetail << ":\n";
+                else if (cum_weighted_ghz < 1)
+                    reportDetail << " \u2248 " << uint64_t(cum_weighted_ghz * 1000) << " MHz:\n";
                 else
-                    reportDetail << std::setprecision(1) << cum_weighted_ghz << " GHz:\n" << std::setprecision(2);
+                    reportDetail << " \u2248 " << Fixed { cum_weighted_ghz, 1 } << " GHz:\n";
 
                 dumpPercent("user",   diff.user,   ncpu.user);
                 dumpPercent("nice",   diff.nice,   ncpu.nice);
@@ -694,43 +3118,122 @@ int main(int argc, char** argv)
                 if (ncpu.guest)     dumpPercent("guest",      diff.guest,     ncpu.guest);
                 if (ncpu.guestnice) dumpPercent("guest nice", diff.guestnice, ncpu.guestnice);
 
-                int maxCpu = 8;
-                for (auto itc = rankByGhzUsage.crbegin(); maxCpu-- && (itc != rankByGhzUsage.crend()); ++itc)
+                const CPU::Throttling& nthr = fresh.cpu->throttling;
+                const CPU::Throttling& othr = old.cpu->throttling;
+                if (nthr.periods > othr.periods) // cgroup quota
+                {
+                    double throttled = 100.0 * (nthr.throttledPeriods - othr.throttledPeriods)
+                                     / (nthr.periods - othr.periods);
+                    reportDetail << "   " << Padded<double> { 100, throttled, 2 } << "% throttled  ("
+                                 << (nthr.throttledUsecs - othr.throttledUsecs) / 1000 << " ms) \n";
+                }
+
+                if (settings.cpuHeatmap)
+                {
+                    reportDetail << "   cores";
+                    for (int band = 0; band < 8; band++) reportDetail << " " << blocks[band] << bands[band];
+                    reportDetail << " \n";
+                    std::size_t perLine = std::max<std::size_t>(64, (used.size() + 1) / 2); // (two lines up to 256)
+                    for (std::size_t first = 0; first < used.size(); first += perLine)
+                    {
+                        std::size_t count = std::min(perLine, used.size() - first);
+                        reportDetail << "   " << heatmap.substr(first * 3, count * 3) << " \n";
+                    }
+                }
+
+                for (const CpuStat& cpu : rankByGhzUsage)
                 {
-                    reportDetail << "   " << std::fixed
-                        << std::setprecision(2) << Padded<double> { 100, itc->second.percent } << "% cpu "
-                        << Padded<CPU::Number> { uint64_t(new_CPU->cores.size() > 10? 10 : 1), itc->second.number }
-                        << "  @" << std::setprecision(3) << Padded<double> { 10, itc->second.ghz } << " GHz \n";
+                    reportDetail << "   " << Padded<double> { 100, cpu.percent, 2 } << "% cpu "
+                        << Padded<CPU::Number> { uint64_t(fresh.cpu->size() >= 10? 10 : 1), cpu.number, 0 };
+                    if (settings.frequency) reportDetail << "  @" << Padded<double> { 10, cpu.ghz, 3 } << " GHz";
+                    if (fresh.throttle && old.throttle)
+                    {
+                        if (fresh.throttle->throttledSince(*old.throttle, cpu.number)) reportDetail << " \u2668"; // hot
+                        if (fresh.throttle->capped(cpu.number))
+                            reportDetail << " \u2264" << Fixed { fresh.throttle->cores[cpu.number].maxKhz / MB_f, 1 }
+                                         << " GHz";
+                    }
+                    reportDetail << " \n";
                 }
+
+                double perTick = settings.cgroup.empty()? 1 : 1e6 / sysconf(_SC_CLK_TCK); // (cgroup: usecs)
+                if (settings.topProcesses && fresh.processes && old.processes)
+                    for (const auto& ranked : fresh.processes->top(*old.processes, settings.topProcesses, false))
+                        reportDetail << "   " << Padded<double> { 100, 100.0 * ranked.delta * perTick / cpuTotal, 2 }
+                                     << "% " << ranked.task->comm << " (" << ranked.task->pid << ") \n";
             }
         }
     }
 
-    if (new_Memory) // RAM report
+    if (fresh.memory) // RAM report
     {
-        if (new_CPU && (!posTemp || (posRam < posTemp)))
-            reportStd << " " << new_Memory->ram.available/1024 << "M" << (singleLine? " " : "\n");
+        if (fresh.cpu && (!settings.posTemp || (settings.posRam < settings.posTemp)))
+            reportStd << " " << fresh.memory->ram.available/1024 << "M" << (settings.singleLine? " " : "\n");
 
-        reportDetail << " Memory " << new_Memory->ram.total/1024 << " MiB:\n"
-            << Padded<uint64_t> { 1000000, new_Memory->ram.available/1024 } << " MiB available \n"
-            << Padded<uint64_t> { 1000000, (new_Memory->ram.cached+new_Memory->ram.buffers)/1024 }
+        reportDetail << " Memory " << fresh.memory->ram.total/1024 << " MiB:\n"
+            << Padded<uint64_t> { 1000000, fresh.memory->ram.available/1024, 0 } << " MiB available \n"
+            << Padded<uint64_t> { 1000000, (fresh.memory->ram.cached+fresh.memory->ram.buffers)/1024, 0 }
             << " MiB cache/buff \n";
 
-        if (new_Memory->ram.shared)
-            reportDetail << Padded<uint64_t> { 1000000, new_Memory->ram.shared/1024 } << " MiB shared \n";
+        if (fresh.memory->ram.shared)
+            reportDetail << Padded<uint64_t> { 1000000, fresh.memory->ram.shared/1024, 0 } << " MiB shared \n";
 
-        if (new_Memory->ram.swapTotal)
-            reportDetail << Padded<uint64_t> { 1000000, (new_Memory->ram.swapTotal-new_Memory->ram.swapFree)/1024 }
-                         << " MiB swap of " << new_Memory->ram.swapTotal/1024 << " \n";
+        if (fresh.memory->ram.swapTotal)
+            reportDetail << Padded<uint64_t> { 1000000, (fresh.memory->ram.swapTotal-fresh.memory->ram.swapFree)/1024,
+                                               0 } << " MiB swap of " << fresh.memory->ram.swapTotal/1024 << " \n";
+    }
+
+    double numaSecs = fresh.numa && old.numa? Sample::secsBetween(fresh.numa->nowIs, old.numa->nowIs) : 0;
+    if (numaSecs > 0) // NUMA report: the nodes' share of their cores and their memory
+    {
+        struct NodeStat { int64_t used, total; uint64_t freq_hz; std::size_t cores; };
+        std::map<int32_t, NodeStat> statByNode;
+        if (fresh.cpu && old.cpu)
+        {
+            std::vector<int64_t> used, total;
+            fresh.cpu->deltas(*old.cpu, used, total);
+            for (std::size_t number = 0; number < std::min(used.size(), fresh.numa->nodeOfCore.size()); number++)
+            {
+                if (!total[number] || (fresh.numa->nodeOfCore[number] < 0)) continue;
+                NodeStat& node = statByNode[fresh.numa->nodeOfCore[number]];
+                node.used += used[number];
+                node.total += total[number];
+                node.freq_hz += (fresh.cpu->freq_hz[number] + old.cpu->freq_hz[number]) / 2;
+                node.cores++;
+            }
+        }
+        reportDetail << " NUMA:\n";
+        for (const auto& itn : fresh.numa->nodes)
+        {
+            auto ito = old.numa->nodes.find(itn.first);
+            if (ito == old.numa->nodes.end()) continue;
+            const Numa::Node& node = itn.second;
+            reportDetail << "    node " << itn.first << ":";
+            auto its = statByNode.find(itn.first);
+            if ((its != statByNode.end()) && its->second.total)
+            {
+                reportDetail << " " << Fixed { 100.0 * its->second.used / its->second.total, 1 } << "%";
+                if (settings.frequency)
+                    reportDetail << " @ " << Fixed { its->second.freq_hz / its->second.cores / GB_f, 2 } << " GHz";
+                reportDetail << ",";
+            }
+            reportDetail << " " << node.freeKb / 1024 << " of " << node.totalKb / 1024 << " MiB free \n";
+            uint64_t misses = node.numaMiss - ito->second.numaMiss;
+            uint64_t foreign = node.numaForeign - ito->second.numaForeign;
+            uint64_t remote = node.otherNode - ito->second.otherNode;
+            if (misses || foreign || remote)
+                reportDetail << "      " << int64_t(misses / numaSecs) << " miss, " << int64_t(foreign / numaSecs)
+                             << " foreign, " << int64_t(remote / numaSecs) << " remote pages/s \n";
+        }
     }
 
-    if (new_IO && old_IO && nsecsElapsed) // IO report
+    if (ioSecs > 0) // IO report
     {
-        for (auto nitd = new_IO->devices.cbegin(); nitd != new_IO->devices.cend(); ++nitd)
+        for (auto nitd = fresh.io->devices.cbegin(); nitd != fresh.io->devices.cend(); ++nitd)
         {
             const IO::Device& device = nitd->second;
-            auto prevdev = old_IO->devices.find(nitd->first);
-            if ((device.bytesRead || device.bytesWritten) && (prevdev != old_IO->devices.end()))
+            auto prevdev = old.io->devices.find(nitd->first);
+            if ((device.bytesRead || device.bytesWritten) && (prevdev != old.io->devices.end()))
             {
                 reportDetail << " " << nitd->first << " \u26C1 " << DataSize { device.bytesSize } << ":\n";
 
@@ -738,17 +3241,39 @@ int main(int argc, char** argv)
                 {
                     auto transferred = newBytes - oldBytes;
                     reportDetail << "    " << (transferred? iconBusy : iconIdle) << "  " << DataSize { newBytes };
-                    if (transferred) reportDetail << " - " << IO::Bandwidth { transferred / secsElapsed };
+                    if (transferred) reportDetail << " - " << IO::Bandwidth { transferred / ioSecs };
                     reportDetail << " \n";
                 };
 
                 dumpIO("\u25B3", "\u25B2", device.bytesWritten, prevdev->second.bytesWritten);
                 dumpIO("\u25BD", "\u25BC", device.bytesRead, prevdev->second.bytesRead);
+
+                IO::Activity activity = IO::activity(device, prevdev->second, ioSecs);
+                if (activity.iops > 0)
+                {
+                    reportDetail << "    " << int64_t(activity.iops + 0.5) << " IOPS";
+                    if (device.ioMsecs)
+                        reportDetail << ", " << Fixed { activity.utilization, 1 } << "% util, await "
+                                     << Fixed { activity.readAwait, 2 } << "|" << Fixed { activity.writeAwait, 2 }
+                                     << " ms, queue " << Fixed { activity.queueDepth, 2 };
+                    reportDetail << " \n";
+                }
             }
         }
+
+        double procSecs = settings.topProcesses && fresh.processes && old.processes?
+                          Sample::secsBetween(fresh.processes->nowIs, old.processes->nowIs) : 0;
+        if (procSecs > 0)
+            for (const auto& ranked : fresh.processes->top(*old.processes, settings.topProcesses, true))
+            {
+                reportDetail << " " << ranked.task->comm << " (" << ranked.task->pid << "):";
+                if (ranked.bytesWritten) reportDetail << " \u25B2 " << IO::Bandwidth { ranked.bytesWritten / procSecs };
+                if (ranked.bytesRead) reportDetail << " \u25BC " << IO::Bandwidth { ranked.bytesRead / procSecs };
+                reportDetail << " \n";
+            }
     }
 
-    if (new_Health) // TEMP report
+    if (fresh.health) // TEMP report
     {
         struct ThermalStat
         {
@@ -765,7 +3290,7 @@ int main(int argc, char** argv)
 
         std::map<std::string, ThermalStat> statByCategory;
         int32_t maxAbsTemp = std::numeric_limits<int32_t>::min();
-        for (const auto& itt : new_Health->thermometers)
+        for (const auto& itt : fresh.health->thermometers)
         {
             std::string key = itt.first;
             auto catEnd = key.find(" ");
@@ -784,8 +3309,8 @@ int main(int argc, char** argv)
             its->second.avg = (prevTotal + itt.second.tempMilliCelsius) / its->second.count;
         }
 
-        if (new_CPU && (maxAbsTemp >= 0) && (!posRam || (posTemp < posRam)))
-            reportStd << std::setw(4) << maxAbsTemp / 1000 << "ºC" << (singleLine? " " : "\n");
+        if (fresh.cpu && (maxAbsTemp >= 0) && (!settings.posRam || (settings.posTemp < settings.posRam)))
+            reportStd.width(4) << maxAbsTemp / 1000 << "ºC" << (settings.singleLine? " " : "\n");
 
         if (!statByCategory.empty()) reportDetail << " Temperature: \n";
 
@@ -801,14 +3326,908 @@ int main(int argc, char** argv)
         }
     }
 
-    std::string sReportStd = reportStd.str();
-    if (!sReportStd.empty() && (sReportStd.back() == '\n')) sReportStd.erase(sReportStd.end()-1);
+    double throttleSecs = fresh.throttle && old.throttle?
+                          Sample::secsBetween(fresh.throttle->nowIs, old.throttle->nowIs) : 0;
+    if (throttleSecs > 0) // throttling report (below the temperatures)
+    {
+        uint64_t coreEvents = 0, packageEvents = 0;
+        std::size_t capped = 0;
+        std::vector<int32_t> packages; // counted once
+        const std::vector<Throttle::Core>& cores = fresh.throttle->cores;
+        for (std::size_t number = 0; number < std::min(cores.size(), old.throttle->cores.size()); number++)
+        {
+            const Throttle::Core& was = old.throttle->cores[number];
+            if ((cores[number].package < 0) || (was.package != cores[number].package)) continue;
+            coreEvents += cores[number].coreEvents - std::min(cores[number].coreEvents, was.coreEvents);
+            if (std::find(packages.begin(), packages.end(), cores[number].package) == packages.end())
+            {
+                packages.push_back(cores[number].package);
+                packageEvents += cores[number].packageEvents - std::min(cores[number].packageEvents, was.packageEvents);
+            }
+            if (fresh.throttle->capped(number)) capped++;
+        }
+        bool belowTemperatures = fresh.health && !fresh.health->thermometers.empty();
+        reportDetail << (belowTemperatures? "    throttling: " : " Throttling: ")
+                     << Fixed { coreEvents / throttleSecs, 1 } << " core, "
+                     << Fixed { packageEvents / throttleSecs, 1 } << " package events/s";
+        if (capped) reportDetail << ", " << capped << " cores capped";
+        reportDetail << " \n";
+    }
+
+    double psiSecs = fresh.pressure && old.pressure?
+                     Sample::secsBetween(fresh.pressure->nowIs, old.pressure->nowIs) : 0;
+    if (psiSecs > 0) // PSI report: share of the interval with some (all) tasks stalled on each resource
+    {
+        auto share = [&](const std::vector<Pressure::Stall>& now, const std::vector<Pressure::Stall>& was, int resource)
+        {
+            return (now[resource].totalUsecs - was[resource].totalUsecs) / (psiSecs * 10000);
+        };
+        double worst = -1;
+        for (int resource = 0; resource < Pressure::RESOURCES; resource++)
+        {
+            if (!fresh.pressure->some[resource].available || !old.pressure->some[resource].available) continue;
+            double some = share(fresh.pressure->some, old.pressure->some, resource);
+            reportDetail << (worst < 0? " Pressure: " : "  ") << Pressure::name(resource) << " " << Fixed { some, 1 };
+            worst = std::max(worst, some);
+            if (fresh.pressure->full[resource].totalUsecs) // (the system wide cpu "full" line is always zero)
+                reportDetail << "|" << Fixed { share(fresh.pressure->full, old.pressure->full, resource), 1 };
+            reportDetail << "%";
+        }
+        if (worst >= 0) reportDetail << " \n";
+        if (worst >= 0) // the kernel's own averages of the some shares
+        {
+            const char* separator = "   avg 10s|60s: ";
+            for (int resource = 0; resource < Pressure::RESOURCES; resource++)
+                if (fresh.pressure->some[resource].available && old.pressure->some[resource].available)
+                    reportDetail << separator << Pressure::name(resource) << " "
+                                 << Fixed { fresh.pressure->some[resource].avg10, 1 } << "|"
+                                 << Fixed { fresh.pressure->some[resource].avg60, 1 } << "%", separator = "  ";
+            reportDetail << " \n";
+        }
+        if (settings.pressureText && (worst >= 0))
+            reportStd.width(5) << Fixed { worst, 1 } << "%\u29D7" << (settings.singleLine? " " : "\n"); // hourglass
+    }
+
+}
+
+void renderHistory(const Settings& settings, const History& history, Output& reportDetail)
+{
+    if (history.series.empty()) return;
+    reportDetail << " Trends (" << settings.historyTicks << " ticks):\n";
+    for (const auto& its : history.series)
+    {
+        std::vector<int64_t> values = history.values(its.first, settings.historyTicks);
+        if (values.empty()) continue;
+
+        std::string name = its.first.substr(its.first.find(':') + 1);
+        auto dumpValue = [&](double value)
+        {
+            if (its.first == "cpu")
+                reportDetail << Fixed { value / 100, 1 } << "%";
+            else if (its.first == "temp")
+                reportDetail << int64_t(value / 1000) << "\u00BAC";
+            else if (its.first.find("net:") == 0)
+                reportDetail << Network::Bandwidth { settings.netSpeedUnit,
+                    int64_t((settings.netSpeedUnit == Network::Bandwidth::Unit::byte? 1 : 8) * value) };
+            else
+                reportDetail << IO::Bandwidth { value };
+        };
+        auto average = [&](std::size_t ticks)
+        {
+            ticks = std::min(ticks, values.size());
+            double sum = 0;
+            for (auto itv = values.end() - ticks; itv != values.end(); ++itv) sum += *itv;
+            return sum / ticks;
+        };
+
+        int64_t peak = *std::max_element(values.begin(), values.end());
+        int64_t low = *std::min_element(values.begin(), values.end());
+        const std::size_t width = 20; // sparkline of the maximum in each bucket of ticks
+        std::size_t buckets = std::min(width, values.size());
+        reportDetail << "    " << (name == "cpu"? "CPU" : name == "temp"? "Temp" : name) << " ";
+        for (std::size_t bucket = 0; bucket < buckets; bucket++)
+        {
+            auto from = values.begin() + bucket * values.size() / buckets;
+            auto to = values.begin() + (bucket + 1) * values.size() / buckets;
+            int64_t top = *std::max_element(from, to);
+            static const char* levels[] = { "\u2581", "\u2582", "\u2583", "\u2584",
+                                            "\u2585", "\u2586", "\u2587", "\u2588" };
+            reportDetail << levels[peak > low? std::min<int64_t>(7, 8 * (top - low) / (peak - low)) : 0];
+        }
+        reportDetail << " ";
+        dumpValue(average(1)); reportDetail << " / ";
+        dumpValue(average(5)); reportDetail << " / ";
+        dumpValue(average(15)); reportDetail << "  peak ";
+        dumpValue(peak);
+        reportDetail << " \n";
+    }
+}
+
+void renderStats(const Timings& measured, const Diagnostics& diagnostics, Output& reportDetail)
+{
+    reportDetail << " Monitor cost:\n";
+    for (int phase = 0; phase < Timings::PHASES; phase++)
+    {
+        if (!measured.nsecs[phase]) continue;
+        reportDetail << "    " << Timings::name(phase) << ": " << Fixed { measured.nsecs[phase] / MB_f, 2 } << " ms ("
+                     << Fixed { measured.cpuNsecs[phase] / MB_f, 2 } << " cpu) \n";
+    }
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    reportDetail << "    " << measured.opens << " opens, " << measured.reads << " reads, "
+                 << usage.ru_maxrss << " KiB max RSS \n";
+
+    std::vector<std::pair<uint64_t, std::string>> files;
+    for (const auto& itf : measured.bytesRead) files.push_back({ itf.second, itf.first });
+    auto topFiles = files.begin() + std::min<std::size_t>(5, files.size());
+    std::partial_sort(files.begin(), topFiles, files.end(), std::greater<std::pair<uint64_t, std::string>>());
+    for (auto itf = files.begin(); itf != topFiles; ++itf)
+        reportDetail << "    " << itf->first << " bytes " << itf->second << " \n";
+
+    if (!diagnostics.latencyUsecs.empty())
+        reportDetail << "    latency p50 " << Fixed { diagnostics.percentile(50) / 1000.0, 2 } << " ms, p99 "
+                     << Fixed { diagnostics.percentile(99) / 1000.0, 2 } << " ms (last "
+                     << diagnostics.latencyUsecs.size() << " ticks) \n";
+}
+
+std::string report(const Settings& settings, const Sample& fresh, const Sample& old)
+{
+    Output reportStd(256), reportDetail(4096);
+    {
+        Probe probe(Timings::REPORT);
+        render(settings, fresh, old, reportStd, reportDetail);
+    }
+    if (fresh.history) renderHistory(settings, *fresh.history, reportDetail);
+    if (timings && fresh.diagnostics) renderStats(*timings, *fresh.diagnostics, reportDetail);
+
+    reportStd.chopNewline();
+    if (reportStd.empty()) reportStd << "Hacker's\nMonitor"; // dummy message (allow the user to right-click)
+    reportDetail.chopNewline();
+
+    Output output(reportStd.str().length() + reportDetail.str().length() + 32);
+    output << "<txt>" << reportStd.str() << "</txt><tool>" << reportDetail.str() << "</tool>";
+    return output.str();
+}
+
+struct Label { const std::string& value; }; // OpenMetrics label value (escaped)
+
+Output& operator<<(Output& out, const Label& label)
+{
+    for (char c : label.value)
+    {
+        if ((c == '\\') || (c == '"')) out << '\\' << c;
+        else if (c == '\n') out << "\\n";
+        else out << c;
+    }
+    return out;
+}
+
+void renderMetrics(const Sample& sample, Output& out) // OpenMetrics text straight from the collected counters
+{
+    auto family = [&](const char* name, const char* type, const char* help)
+    {
+        out << "# TYPE hkmon_" << name << " " << type << "\n# HELP hkmon_" << name << " " << help << "\n";
+    };
+    if (sample.cpu)
+    {
+        static const char* modes[CPU::COUNTERS] = { "user", "nice", "system", "idle", "iowait", "irq", "softirq",
+                                                    "steal", "guest", "guest_nice" };
+        static const double hertz = sysconf(_SC_CLK_TCK);
+        family("cpu_seconds", "counter", "Time spent by each core in each mode (user and nice exclude the guests).");
+        for (std::size_t number = 0; number < sample.cpu->size(); number++)
+        {
+            if (!sample.cpu->online[number]) continue;
+            for (int c = 0; c < CPU::COUNTERS; c++)
+                out << "hkmon_cpu_seconds_total{cpu=\"" << number << "\",mode=\"" << modes[c] << "\"} "
+                    << Fixed { sample.cpu->jiffies[c][number] / hertz, 2 } << "\n";
+        }
+        if (sample.cpu->throttling.periods)
+        {
+            family("cpu_throttled_seconds", "counter", "Time the cgroup was throttled by its CPU quota.");
+            out << "hkmon_cpu_throttled_seconds_total " << Fixed { sample.cpu->throttling.throttledUsecs / MB_f, 6 }
+                << "\n";
+        }
+        family("cpu_frequency_hertz", "gauge", "Current clock of each core.");
+        for (std::size_t number = 0; number < sample.cpu->size(); number++)
+            if (sample.cpu->online[number] && sample.cpu->freq_hz[number])
+                out << "hkmon_cpu_frequency_hertz{cpu=\"" << number << "\"} " << sample.cpu->freq_hz[number] << "\n";
+    }
+    if (sample.memory)
+    {
+        const Memory::RAM& ram = sample.memory->ram;
+        const std::pair<const char*, uint64_t> fields[] =
+        {
+            { "total", ram.total }, { "available", ram.available }, { "free", ram.free }, { "shared", ram.shared },
+            { "buffers", ram.buffers }, { "cached", ram.cached }, { "swap_total", ram.swapTotal },
+            { "swap_free", ram.swapFree }
+        };
+        family("memory_bytes", "gauge", "Memory figures from /proc/meminfo.");
+        for (const auto& field : fields)
+            out << "hkmon_memory_bytes{kind=\"" << field.first << "\"} " << field.second * 1024 << "\n";
+    }
+    if (sample.io)
+    {
+        family("disk_read_bytes", "counter", "Bytes read from each disk.");
+        for (const auto& itd : sample.io->devices)
+            out << "hkmon_disk_read_bytes_total{device=\"" << Label { itd.first } << "\"} "
+                << itd.second.bytesRead << "\n";
+        family("disk_written_bytes", "counter", "Bytes written to each disk.");
+        for (const auto& itd : sample.io->devices)
+            out << "hkmon_disk_written_bytes_total{device=\"" << Label { itd.first } << "\"} "
+                << itd.second.bytesWritten << "\n";
+        family("disk_io_time_seconds", "counter", "Time each disk spent doing I/O.");
+        for (const auto& itd : sample.io->devices)
+            out << "hkmon_disk_io_time_seconds_total{device=\"" << Label { itd.first } << "\"} "
+                << Fixed { itd.second.ioMsecs / 1000.0, 3 } << "\n";
+        family("disk_completed", "counter", "Reads and writes completed by each disk.");
+        for (const auto& itd : sample.io->devices)
+            out << "hkmon_disk_completed_total{device=\"" << Label { itd.first } << "\",op=\"read\"} "
+                << itd.second.reads << "\nhkmon_disk_completed_total{device=\"" << Label { itd.first }
+                << "\",op=\"write\"} " << itd.second.writes << "\n";
+        family("disk_queue_seconds", "counter", "Time spent by the requests of each disk, weighted by their number.");
+        for (const auto& itd : sample.io->devices)
+            out << "hkmon_disk_queue_seconds_total{device=\"" << Label { itd.first } << "\"} "
+                << Fixed { itd.second.queueMsecs / 1000.0, 3 } << "\n";
+        family("disk_size_bytes", "gauge", "Capacity of each disk.");
+        for (const auto& itd : sample.io->devices)
+            out << "hkmon_disk_size_bytes{device=\"" << Label { itd.first } << "\"} " << itd.second.bytesSize << "\n";
+    }
+    if (sample.network)
+    {
+        family("network_receive_bytes", "counter", "Bytes received by each interface.");
+        for (const auto& itn : sample.network->interfaces)
+            out << "hkmon_network_receive_bytes_total{interface=\"" << Label { itn.first } << "\"} "
+                << itn.second.bytesRecv << "\n";
+        family("network_transmit_bytes", "counter", "Bytes sent by each interface.");
+        for (const auto& itn : sample.network->interfaces)
+            out << "hkmon_network_transmit_bytes_total{interface=\"" << Label { itn.first } << "\"} "
+                << itn.second.bytesSent << "\n";
+        auto counters = [&](const char* name, const char* help, uint64_t Network::Interface::* recv,
+                            uint64_t Network::Interface::* sent)
+        {
+            family(name, "counter", help);
+            for (const auto& itn : sample.network->interfaces)
+                out << "hkmon_" << name << "_total{interface=\"" << Label { itn.first } << "\",direction=\"receive\"} "
+                    << itn.second.*recv << "\nhkmon_" << name << "_total{interface=\"" << Label { itn.first }
+                    << "\",direction=\"transmit\"} " << itn.second.*sent << "\n";
+        };
+        counters("network_packets", "Packets of each interface.", &Network::Interface::packetsRecv,
+                 &Network::Interface::packetsSent);
+        counters("network_errors", "Faulty packets of each interface.", &Network::Interface::errorsRecv,
+                 &Network::Interface::errorsSent);
+        counters("network_drops", "Packets dropped by each interface.", &Network::Interface::dropsRecv,
+                 &Network::Interface::dropsSent);
+    }
+    if (sample.health && !sample.health->thermometers.empty())
+    {
+        family("temperature_celsius", "gauge", "Coretemp sensors.");
+        for (const auto& itt : sample.health->thermometers)
+            out << "hkmon_temperature_celsius{sensor=\"" << Label { itt.first } << "\"} "
+                << Fixed { itt.second.tempMilliCelsius / 1000.0, 3 } << "\n";
+    }
+    if (sample.throttle)
+    {
+        family("thermal_throttle_events", "counter", "Thermal throttling events of each core (and its package).");
+        for (std::size_t number = 0; number < sample.throttle->cores.size(); number++)
+        {
+            const Throttle::Core& core = sample.throttle->cores[number];
+            if (core.package < 0) continue;
+            out << "hkmon_thermal_throttle_events_total{cpu=\"" << number << "\",scope=\"core\"} " << core.coreEvents
+                << "\nhkmon_thermal_throttle_events_total{cpu=\"" << number << "\",scope=\"package\"} "
+                << core.packageEvents << "\n";
+        }
+    }
+    if (sample.numa)
+    {
+        family("numa_free_bytes", "gauge", "Free memory of each node.");
+        for (const auto& itn : sample.numa->nodes)
+            out << "hkmon_numa_free_bytes{node=\"" << itn.first << "\"} " << itn.second.freeKb * 1024 << "\n";
+        family("numa_miss_pages", "counter", "Pages allocated on each node although another one was preferred.");
+        for (const auto& itn : sample.numa->nodes)
+            out << "hkmon_numa_miss_pages_total{node=\"" << itn.first << "\"} " << itn.second.numaMiss << "\n";
+        family("numa_foreign_pages", "counter", "Pages preferring each node allocated on another one.");
+        for (const auto& itn : sample.numa->nodes)
+            out << "hkmon_numa_foreign_pages_total{node=\"" << itn.first << "\"} " << itn.second.numaForeign << "\n";
+    }
+    if (sample.pressure)
+    {
+        family("pressure_stalled_seconds", "counter", "Time some (full: all) non-idle tasks stalled on a resource.");
+        for (int resource = 0; resource < Pressure::RESOURCES; resource++)
+            for (const auto* stalls : { &sample.pressure->some, &sample.pressure->full })
+                if ((*stalls)[resource].available)
+                    out << "hkmon_pressure_stalled_seconds_total{resource=\"" << Pressure::name(resource)
+                        << "\",kind=\"" << (stalls == &sample.pressure->some? "some" : "full") << "\"} "
+                        << Fixed { (*stalls)[resource].totalUsecs / MB_f, 6 } << "\n";
+        family("pressure_average_ratio", "gauge", "Share of time some (full: all) non-idle tasks stalled on a resource,"
+                                                  " averaged by the kernel over 10 and 60 seconds.");
+        for (int resource = 0; resource < Pressure::RESOURCES; resource++)
+            for (const auto* stalls : { &sample.pressure->some, &sample.pressure->full })
+                if ((*stalls)[resource].available)
+                    for (int window : { 10, 60 })
+                    {
+                        double average = window == 10? (*stalls)[resource].avg10 : (*stalls)[resource].avg60;
+                        out << "hkmon_pressure_average_ratio{resource=\"" << Pressure::name(resource)
+                            << "\",kind=\"" << (stalls == &sample.pressure->some? "some" : "full") << "\",window=\""
+                            << window << "s\"} " << Fixed { average / 100, 4 } << "\n";
+                    }
+    }
+    out << "# EOF\n";
+}
+
+bool daemonAddress(const Settings& settings, int locTry, sockaddr_un& address)
+{
+    Output suffix(32);
+    suffix << "." << Hex { std::hash<std::string>()(settings.arguments) } << ".sock";
+    std::string path = runtimeFile(locTry, suffix.str().c_str());
+    if (path.length() >= sizeof(address.sun_path)) return false;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path.c_str());
+    return true;
+}
+
+bool queryDaemon(const Settings& settings) // a daemon serving the same arguments does all the work
+{
+    for (int locTry = 0; locTry < 2; locTry++)
+    {
+        sockaddr_un address;
+        if (!daemonAddress(settings, locTry, address)) continue;
+        struct stat info; // no socket: no daemon (the usual case, so not even a connection attempt)
+        if ((lstat(address.sun_path, &info) != 0) || !S_ISSOCK(info.st_mode) || (info.st_uid != getuid())) continue;
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) return false;
+        timeval timeout = { 5, 0 };
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        ucred peer; // the daemon must run as this user (another one may have bound the name in /tmp first)
+        socklen_t peerLength = sizeof(peer);
+        if ((connect(fd, (sockaddr*) &address, sizeof(address)) == 0)
+            && (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &peer, &peerLength) == 0) && (peer.uid == getuid()))
+        {
+            std::string output;
+            char buffer[4096];
+            ssize_t bytes;
+            while ((bytes = ::read(fd, buffer, sizeof(buffer))) > 0) output.append(buffer, bytes);
+            close(fd);
+            if ((bytes < 0) || output.empty()) return false;
+            Output::writeFully(STDOUT_FILENO, output);
+            return true;
+        }
+        close(fd);
+    }
+    return false;
+}
+
+void runDaemon(const Settings& settings) // sample on each client request keeping the previous one in memory
+{
+    signal(SIGPIPE, SIG_IGN);
+    int server = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (server < 0) abortApp("socket");
+    for (int locTry = 0;; locTry++)
+    {
+        sockaddr_un address;
+        if (locTry > 1) abortApp("can't bind the daemon socket");
+        if (!daemonAddress(settings, locTry, address)) continue;
+        unlink(address.sun_path);
+        if ((bind(server, (sockaddr*) &address, sizeof(address)) == 0) && (chmod(address.sun_path, 0600) == 0)) break;
+    }
+    if (listen(server, 8) != 0) abortApp("listen");
+
+    keepFiles();
+    Sample previous = collect(settings, Sample());
+    for (;;)
+    {
+        int client = accept4(server, nullptr, nullptr, SOCK_CLOEXEC);
+        if (client < 0)
+        {
+            if (errno == EINTR) continue;
+            abortApp("accept");
+        }
+        Timings measured = Timings();
+        if (settings.stats) timings = &measured;
+        uint64_t tickStart = monotonicNsecs();
+        Sample fresh = collect(settings, previous);
+        if (fresh.diagnostics) fresh.diagnostics->record(monotonicNsecs() - tickStart);
+        std::string output = report(settings, fresh, previous);
+        timings = nullptr;
+        previous = fresh;
+        Output::writeFully(client, output);
+        close(client);
+    }
+}
+
+// Exporter mode: every connection is answered (whatever its HTTP request) with the metrics of a sample, taken
+// again only after a whole applet period, so scrapers running close together don't read /proc again
+const uint64_t SCRAPE_CACHE_NSECS = GB_i;
+const uint64_t REQUEST_WAIT_NSECS = 200 * MB_i; // then answered anyway (a silent client doesn't hold up the others)
+
+int exporterSocket(const Settings& settings)
+{
+    if (settings.exportPort > 0)
+    {
+        int server = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (server < 0) abortApp("socket");
+        int reuse = 1;
+        setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        sockaddr_in address;
+        memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.sin_port = htons(uint16_t(settings.exportPort));
+        if (bind(server, (sockaddr*) &address, sizeof(address)) != 0) abortApp("can't bind the exporter port");
+        return server;
+    }
+    int server = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (server < 0) abortApp("socket");
+    for (int locTry = 0;; locTry++)
+    {
+        if (locTry > 1) abortApp("can't bind the exporter socket");
+        std::string path = runtimeFile(locTry, ".metrics.sock");
+        sockaddr_un address;
+        if (path.length() >= sizeof(address.sun_path)) continue;
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        strcpy(address.sun_path, path.c_str());
+        unlink(address.sun_path);
+        if (bind(server, (sockaddr*) &address, sizeof(address)) == 0) return server;
+    }
+}
+
+void runExporter(const Settings& settings)
+{
+    signal(SIGPIPE, SIG_IGN);
+    int server = exporterSocket(settings);
+    if (listen(server, 8) != 0) abortApp("listen");
+
+    keepFiles();
+    Sample previous;
+    std::string response;
+    uint64_t renderedAt = 0;
+    for (;;)
+    {
+        int client = accept4(server, nullptr, nullptr, SOCK_CLOEXEC);
+        if (client < 0)
+        {
+            if ((errno == EINTR) || (errno == ECONNABORTED)) continue;
+            if ((errno != EMFILE) && (errno != ENFILE)) abortApp("accept");
+            std::this_thread::sleep_for(std::chrono::milliseconds(100)); // out of fds for now
+            continue;
+        }
+        char request[4096]; // just waited for (a reply sent before reading it would be reset on close)
+        uint64_t deadline = monotonicNsecs() + REQUEST_WAIT_NSECS;
+        for (std::size_t received = 0; received < sizeof(request);)
+        {
+            uint64_t now = monotonicNsecs();
+            pollfd readable = { client, POLLIN, 0 };
+            int ready = now < deadline? poll(&readable, 1, int((deadline - now + MB_i - 1) / MB_i)) : 0;
+            if ((ready < 0) && (errno == EINTR)) continue;
+            if (ready <= 0) break;
+            ssize_t bytes = ::read(client, request + received, sizeof(request) - received);
+            if ((bytes < 0) && (errno == EINTR)) continue;
+            if (bytes <= 0) break;
+            received += bytes;
+            if (memmem(request, received, "\r\n\r\n", 4)) break;
+        }
+        if (response.empty() || (monotonicNsecs() - renderedAt >= SCRAPE_CACHE_NSECS))
+        {
+            Sample fresh = collect(settings, previous);
+            renderedAt = fresh.nowIs;
+            Output body(response.capacity());
+            renderMetrics(fresh, body);
+            Output header(256);
+            header << "HTTP/1.0 200 OK\r\nContent-Type: application/openmetrics-text; version=1.0.0; charset=utf-8"
+                   << "\r\nContent-Length: " << body.str().length() << "\r\nConnection: close\r\n\r\n";
+            response = header.str() + body.str();
+            previous = fresh;
+        }
+        Output::writeFully(client, response);
+        close(client);
+    }
+}
+
+// RECORD log: a RecordHeader and then frames of state images (see packCategories). A keyframe holds the image as is;
+// the others the zigzag varint deltas of its 64-bit words against the previous image (mostly single zero bytes)
+
+struct RecordHeader
+{
+    char magic[8];
+    uint32_t version; // STATE_VERSION (the image layout)
+    uint32_t periodUsecs;
+};
+
+struct RecordFrame
+{
+    uint32_t keyframe;
+    uint32_t imageBytes;
+    uint32_t payloadBytes;
+    uint32_t reserved;
+};
+
+class FrameCodec
+{
+public:
+    static constexpr uint32_t KEYFRAME_INTERVAL = 100; // replay can start decoding at any of them
+
+    void encode(const std::vector<char>& image, std::string& log) // appends the frame
+    {
+        std::size_t previousWords = words.size();
+        std::vector<uint64_t> previous;
+        previous.swap(words);
+        words.assign((image.size() + 7) / 8, 0);
+        memcpy(words.data(), image.data(), image.size());
+        RecordFrame frame = { 0, uint32_t(image.size()), 0, 0 };
+        if ((++sinceKeyframe >= KEYFRAME_INTERVAL) || (image.size() != imageBytes) || !previousWords)
+        {
+            frame.keyframe = 1;
+            frame.payloadBytes = uint32_t(image.size());
+            log.append(reinterpret_cast<const char*>(&frame), sizeof(frame));
+            log.append(image.data(), image.size());
+            sinceKeyframe = 0;
+        }
+        else
+        {
+            deltas.clear();
+            for (std::size_t w = 0; w < words.size(); w++) History::encode(deltas, int64_t(words[w] - previous[w]));
+            frame.payloadBytes = uint32_t(deltas.size());
+            log.append(reinterpret_cast<const char*>(&frame), sizeof(frame));
+            log.append(reinterpret_cast<const char*>(deltas.data()), deltas.size());
+        }
+        imageBytes = uint32_t(image.size());
+    }
+
+    bool decode(const RecordFrame& frame, const char* payload, std::vector<char>& image)
+    {
+        if (frame.keyframe)
+        {
+            words.assign((frame.imageBytes + 7) / 8, 0);
+            memcpy(words.data(), payload, frame.imageBytes);
+        }
+        else
+        {
+            if (words.empty() || (frame.imageBytes != imageBytes)) return false; // no keyframe before it
+            deltas.assign(payload, payload + frame.payloadBytes);
+            std::size_t pos = 0;
+            for (auto& word : words) word += uint64_t(History::decode(deltas, pos));
+        }
+        imageBytes = frame.imageBytes;
+        const char* bytes = reinterpret_cast<const char*>(words.data());
+        image.assign(bytes, bytes + imageBytes);
+        return true;
+    }
+
+private:
+    std::vector<uint64_t> words; // of the previous image (zero padded)
+    std::vector<uint8_t> deltas;
+    uint32_t imageBytes = 0;
+    uint32_t sinceKeyframe = 0;
+};
+
+volatile sig_atomic_t stopRecording = 0;
+
+void runRecorder(const Settings& settings, const std::string& logFile, uint32_t periodUsecs)
+{
+    int fd = open(logFile.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) abortApp("can't open the record log");
+    struct stat info;
+    if ((fstat(fd, &info) == 0) && info.st_size) // appending: same image layout required
+    {
+        RecordHeader header;
+        int reader = open(logFile.c_str(), O_RDONLY | O_CLOEXEC);
+        bool valid = (reader >= 0) && (::read(reader, &header, sizeof(header)) == sizeof(header))
+                     && !memcmp(header.magic, RECORD_MAGIC, sizeof(header.magic)) && (header.version == STATE_VERSION);
+        if (reader >= 0) close(reader);
+        if (!valid) abortApp("the record log has another format");
+    }
+    else
+    {
+        RecordHeader header = { { 0 }, STATE_VERSION, periodUsecs };
+        memcpy(header.magic, RECORD_MAGIC, sizeof(header.magic));
+        if (write(fd, &header, sizeof(header)) != sizeof(header)) abortApp("can't write the record log");
+    }
+
+    auto stop = [](int) { stopRecording = 1; };
+    signal(SIGINT, stop);
+    signal(SIGTERM, stop);
+    keepFiles();
+    FrameCodec codec;
+    std::string log; // written once per keyframe interval: the ticks in between never block on the disk
+    Sample previous;
+    timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    for (uint32_t frames = 1; !stopRecording; frames++)
+    {
+        Sample fresh = collect(settings, previous);
+        StateImage image;
+        packCategories(image, fresh, 0);
+        codec.encode(image.build(fresh.nowIs), log);
+        previous = fresh;
+        if (frames % FrameCodec::KEYFRAME_INTERVAL == 0)
+        {
+            if (!Output::writeFully(fd, log)) abortApp("can't write the record log");
+            log.clear();
+        }
+        next.tv_nsec += long(periodUsecs) * 1000; // absolute deadlines: the period does not drift with the tick cost
+        next.tv_sec += next.tv_nsec / GB_i;
+        next.tv_nsec %= GB_i;
+        while (!stopRecording && (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, nullptr) == EINTR)) {}
+    }
+    if (!Output::writeFully(fd, log)) abortApp("can't write the record log");
+    close(fd);
+}
+
+struct Peak // average and maximum of a figure over the replayed intervals
+{
+    double sum = 0, max = -1;
+    uint64_t count = 0, maxAt = 0;
+
+    void add(double value, uint64_t at)
+    {
+        sum += value;
+        count++;
+        if (value > max) { max = value; maxAt = at; }
+    }
+};
+
+void runReplay(Settings settings, const std::string& logFile, double atSecs) // atSecs < 0: aggregated statistics
+{
+    std::vector<char> log;
+    int fd = open(logFile.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) abortApp("can't open the record log");
+    char buffer[65536];
+    for (ssize_t bytes; (bytes = ::read(fd, buffer, sizeof(buffer))) != 0;)
+    {
+        if ((bytes < 0) && (errno == EINTR)) continue;
+        if (bytes < 0) abortApp("can't read the record log");
+        log.insert(log.end(), buffer, buffer + bytes);
+    }
+    close(fd);
+    RecordHeader header;
+    if (log.size() < sizeof(header)) abortApp("not a record log");
+    memcpy(&header, log.data(), sizeof(header));
+    if (memcmp(header.magic, RECORD_MAGIC, sizeof(header.magic)) || (header.version != STATE_VERSION))
+        abortApp("not a record log of this version");
+
+    bool selected = settings.cpu || settings.memory || settings.io || settings.network || settings.health
+                    || settings.pressure || settings.numa || settings.throttle;
+    FrameCodec codec;
+    std::vector<char> image;
+    Sample old;
+    uint64_t startIs = 0, frames = 0;
+    Peak cpu;
+    std::map<std::string, Peak> net, io;
+    for (std::size_t offset = sizeof(header); offset + sizeof(RecordFrame) <= log.size();)
+    {
+        RecordFrame frame;
+        memcpy(&frame, &log[offset], sizeof(frame));
+        offset += sizeof(frame);
+        if (offset + frame.payloadBytes > log.size()) break; // cut short while recording
+        bool decoded = codec.decode(frame, &log[offset], image);
+        offset += frame.payloadBytes;
+        StateImage state(image);
+        if (!decoded || !state.valid()) continue;
+        Sample fresh = unpackCategories(state, 0);
+        if (selected)
+        {
+            if (!settings.cpu) fresh.cpu.reset();
+            if (!settings.memory) fresh.memory.reset();
+            if (!settings.io) fresh.io.reset();
+            if (!settings.network) fresh.network.reset();
+            if (!settings.health) fresh.health.reset();
+            if (!settings.pressure) fresh.pressure.reset();
+            if (!settings.numa) fresh.numa.reset();
+            if (!settings.throttle) fresh.throttle.reset();
+            if (!settings.topProcesses) fresh.processes.reset();
+        }
+        if (!frames++ || (fresh.nowIs < old.nowIs)) startIs = fresh.nowIs; // (appended after a reboot)
+        uint64_t at = fresh.nowIs - startIs;
+        if ((atSecs >= 0) && old.nowIs && (at >= atSecs * GB_f))
+        {
+            Output::writeFully(STDOUT_FILENO, report(settings, fresh, old));
+            return;
+        }
+        if (fresh.cpu && old.cpu)
+        {
+            CPU::Core diff = fresh.cpu->all - old.cpu->all;
+            if (diff.cpuTotal() > 0) cpu.add(100.0 * diff.cpuUsed() / diff.cpuTotal(), at);
+        }
+        double netSecs = fresh.network && old.network?
+                         Sample::secsBetween(fresh.network->nowIs, old.network->nowIs) : 0;
+        if (netSecs > 0) for (const auto& itn : fresh.network->interfaces)
+        {
+            auto ito = old.network->interfaces.find(itn.first);
+            if (ito != old.network->interfaces.end())
+                net[itn.first].add((itn.second.traffic() - ito->second.traffic()) / netSecs, at);
+        }
+        double ioSecs = fresh.io && old.io? Sample::secsBetween(fresh.io->nowIs, old.io->nowIs) : 0;
+        if (ioSecs > 0) for (const auto& itd : fresh.io->devices)
+        {
+            auto ito = old.io->devices.find(itd.first);
+            if (ito != old.io->devices.end())
+                io[itd.first].add((itd.second.bytesRead + itd.second.bytesWritten - ito->second.bytesRead
+                                   - ito->second.bytesWritten) / ioSecs, at);
+        }
+        old = fresh;
+    }
+    if (atSecs >= 0) abortApp("the record log ends before that moment");
+
+    Output out;
+    out << "xfce-hkmon " << APP_VERSION << " REPLAY: " << frames << " samples over "
+        << Fixed { (old.nowIs - startIs) / GB_f, 3 } << " s (recorded every " << header.periodUsecs / 1000 << " ms)\n";
+    auto dumpPeak = [&](const std::string& name, const Peak& peak, bool bandwidth)
+    {
+        if (!peak.count || (bandwidth && (peak.max <= 0))) return; // (idle devices)
+        out << "  " << name << ": avg ";
+        if (bandwidth) out << IO::Bandwidth { peak.sum / peak.count } << ", max " << IO::Bandwidth { peak.max };
+        else out << Fixed { peak.sum / peak.count, 1 } << "%, max " << Fixed { peak.max, 1 } << "%";
+        out << " at " << Fixed { peak.maxAt / GB_f, 3 } << " s\n";
+    };
+    dumpPeak("CPU", cpu, false);
+    for (const auto& itn : net) dumpPeak("net " + itn.first, itn.second, true);
+    for (const auto& itd : io) dumpPeak("io " + itd.first, itd.second, true);
+    out.writeTo(STDOUT_FILENO);
+}
+
+void runBenchmark(const Settings& settings, int ticks) // standalone (non daemon) ticks split by phase
+{
+    Timings measured = Timings();
+    Sample baseline = collect(settings, Sample()); // the report is rendered against it (non-zero deltas)
+    uint64_t startNsecs = monotonicNsecs();
+    uint64_t startAllocations = heapAllocations;
+    timings = &measured;
+    for (int tick = 0; tick < ticks; tick++)
+    {
+        StateFile stateFile;
+        openState(stateFile, ".bench.state");
+        Sample older;
+        StoredState stored;
+        Sample old = loadState(stateFile, settings, older, stored);
+        Sample fresh = collect(settings, old); // (no reuse: every tick collects)
+        storeState(stateFile, settings, fresh, old, stored);
+        stateFile.close();
+        report(settings, fresh, baseline);
+    }
+    timings = nullptr;
+    uint64_t totalNsecs = monotonicNsecs() - startNsecs;
+    uint64_t totalAllocations = heapAllocations - startAllocations;
+
+    Output out;
+    out << "xfce-hkmon " << APP_VERSION << " BENCH: " << ticks << " ticks, root \""
+        << (sourceRoot.empty()? "/" : sourceRoot) << "\"\n"
+        << "  phase           ns/tick" << (totalAllocations? "   allocs/tick\n" : "\n");
+    auto dumpPhase = [&](const char* name, uint64_t nsecs, uint64_t allocations)
+    {
+        out << "  " << name;
+        out.spaces(12 - std::min<std::size_t>(12, strlen(name)))
+           .width(12) << nsecs / ticks;
+        if (totalAllocations) out.width(14) << Fixed { 1.0 * allocations / ticks, 1 };
+        out << "\n";
+    };
+    for (int phase = 0; phase < Timings::PHASES; phase++)
+        if (measured.nsecs[phase])
+            dumpPhase(Timings::name(phase), measured.nsecs[phase], measured.allocations[phase]);
+    dumpPhase("whole tick", totalNsecs, totalAllocations);
+    out << "  readFile() syscalls per tick: " << Fixed { 1.0 * measured.opens / ticks, 1 } << " opens, "
+        << Fixed { 1.0 * measured.reads / ticks, 1 } << " reads\n";
+    out.writeTo(STDOUT_FILENO);
+}
+
+std::string cgroupDirectory(std::string path) // "=<path below /sys/fs/cgroup>", or empty for the own cgroup
+{
+    bool found = !path.empty();
+    if (!found)
+    {
+        std::vector<char> buffer;
+        readFile("/proc/self/cgroup", buffer);
+        for (Scanner cgroups(buffer); !cgroups.atEnd(); cgroups.nextLine()) // the v2 hierarchy is the "0::" line
+            if (cgroups.until(':') == "0") { cgroups.until(':'); path = cgroups.line().str(); found = true; }
+    }
+    else path.erase(0, 1);
+    if (!path.compare(0, strlen("/sys/fs/cgroup"), "/sys/fs/cgroup")) path.erase(0, strlen("/sys/fs/cgroup"));
+    while (!path.empty() && (path.back() == '/')) path.erase(path.end()-1);
+    if (!path.empty() && (path[0] != '/')) path.insert(0, "/");
+    std::string directory = "/sys/fs/cgroup" + path;
+    if (!found) errno = ENOENT;
+    if (!found || access(rooted(directory + "/cgroup.controllers").c_str(), F_OK)
+        || access(rooted(directory + "/cpu.stat").c_str(), R_OK)) // (v1 and hybrid hierarchies are not supported)
+        abortApp(("not a cgroup v2: " + directory).c_str());
+    return directory;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+         Output usage(512);
+         usage << "usage: " << argv[0] << " [DAEMON|EXPORT[=<port>]|BENCH[=<ticks>]]"
+               << " [RECORD=<file> [EVERY=<msecs>]|REPLAY=<file> [AT=<secs>]]"
+               << " [NET|<network_interface>] [NETINCLUDE=<globs>] [NETEXCLUDE=<globs>] [NETLOSS]"
+               << " [CPU|NOGHZ] [HEATMAP] [TEMP] [IO|DISKS=<devices>] [RAM] [PSI|PSITEXT] [NUMA] [THROTTLE]"
+               << " [TOP=<processes>] [CGROUP[=<path>]]"
+               << " [HISTORY=<ticks>] [STATS] [PARALLEL] [URING]\n";
+         usage.writeTo(STDERR_FILENO);
+         return 1;
+    }
+
+    const char* root = getenv("XFCE_HKMON_ROOT");
+    if (root) sourceRoot = root;
+    while (!sourceRoot.empty() && (sourceRoot.back() == '/')) sourceRoot.erase(sourceRoot.end()-1);
+
+    Settings settings;
+    int benchTicks = 0;
+    std::string recordLog, replayLog;
+    uint32_t recordMsecs = 10;
+    double replayAt = -1;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg(argv[i]);
+        if      ((arg == "DAEMON")) { settings.daemon = true; continue; }
+        else if ((arg == "BENCH"))  { benchTicks = 1000; continue; }
+        else if ((arg.find("BENCH=") == 0)) { benchTicks = atoi(arg.c_str() + 6); continue; }
+        else if ((arg == "EXPORT")) { settings.exportPort = 0; continue; }
+        else if ((arg.find("RECORD=") == 0)) { recordLog = arg.substr(7); continue; }
+        else if ((arg.find("EVERY=") == 0)) { recordMsecs = std::max(1, atoi(arg.c_str() + 6)); continue; }
+        else if ((arg.find("REPLAY=") == 0)) { replayLog = arg.substr(7); continue; }
+        else if ((arg.find("AT=") == 0)) { replayAt = std::max(0.0, atof(arg.c_str() + 3)); continue; }
+        else if ((arg.find("EXPORT=") == 0)) { settings.exportPort = std::max(1, atoi(arg.c_str() + 7)); continue; }
+        else if ((arg.find("NETINCLUDE=") == 0)) settings.network = true, settings.interfaces.include(arg.substr(11));
+        else if ((arg.find("NETEXCLUDE=") == 0)) settings.network = true, settings.interfaces.exclude(arg.substr(11));
+        else if ((arg.find("DISKS=") == 0)) settings.io = true, splitList(arg.substr(6), settings.disks);
+        else if ((arg == "CGROUP") || (arg.find("CGROUP=") == 0)) settings.cgroup = cgroupDirectory(arg.substr(6));
+        else if ((arg.find("HISTORY=") == 0))
+            settings.historyTicks = std::max(2, std::min(3600, atoi(arg.c_str() + 8)));
+        else if ((arg.find("TOP=") == 0)) settings.topProcesses = std::max(0, std::min(50, atoi(arg.c_str() + 4)));
+        else if ((arg == "LINE")) settings.singleLine = true;
+        else if ((arg == "STATS")) settings.stats = true;
+        else if ((arg == "PARALLEL")) settings.parallel = true;
+        else if ((arg == "URING")) batchReads = true;
+        else if ((arg == "CPU"))  settings.cpu = true;
+        else if ((arg == "NOGHZ")) settings.cpu = true, settings.frequency = false;
+        else if ((arg == "HEATMAP")) settings.cpu = true, settings.cpuHeatmap = true;
+        else if ((arg == "RAM"))  settings.posRam = i, settings.memory = true;
+        else if ((arg == "IO"))   settings.io = true;
+        else if ((arg == "NET"))  settings.network = true;
+        else if ((arg == "NET8")) settings.network = true, settings.netSpeedUnit = Network::Bandwidth::Unit::byte;
+        else if ((arg == "NETLOSS")) settings.network = true, settings.netLosses = true;
+        else if ((arg == "TEMP")) settings.posTemp = i, settings.health = true;
+        else if ((arg == "PSI")) settings.pressure = true;
+        else if ((arg == "NUMA")) settings.numa = true;
+        else if ((arg == "THROTTLE")) settings.throttle = true;
+        else if ((arg == "PSITEXT")) settings.pressure = true, settings.pressureText = true;
+        else
+        {
+            settings.network = true;
+            settings.selectedNetworkInterface = argv[i];
+            settings.interfaces.always(argv[i]);
+        }
+        settings.arguments.append(arg).append(" ");
+    }
+
+    if (!settings.cgroup.empty()) settings.frequency = false; // (no per core figures)
+
+    if (benchTicks > 0) { runBenchmark(settings, benchTicks); return 0; }
+
+    if (!recordLog.empty()) { runRecorder(settings, recordLog, recordMsecs * 1000); return 0; }
+
+    if (!replayLog.empty()) { runReplay(settings, replayLog, replayAt); return 0; }
+
+    if (settings.exportPort >= 0) runExporter(settings);
+
+    if (settings.daemon) runDaemon(settings);
 
-    if (sReportStd.empty()) sReportStd = "Hacker's\nMonitor"; // dummy message (allow the user to right-click)
+    if (queryDaemon(settings)) return 0;
 
-    std::string sReportDetail = reportDetail.str();
-    if (!sReportDetail.empty() && (sReportDetail.back() == '\n')) sReportDetail.erase(sReportDetail.end()-1);
+    Timings measured = Timings();
+    if (settings.stats) timings = &measured;
+    uint64_t tickStart = monotonicNsecs();
 
-    std::cout << "<txt>" << sReportStd << "</txt><tool>" << sReportDetail << "</tool>";
+    StateFile stateFile;
+    openState(stateFile);
+    Sample older;
+    StoredState stored;
+    Sample old = loadState(stateFile, settings, older, stored);
+    Sample fresh = collectShared(settings, old, older); // (old: the reused categories now hold their previous sample)
+    if (fresh.diagnostics) fresh.diagnostics->record(monotonicNsecs() - tickStart); // sampling latency
+    storeState(stateFile, settings, fresh, old, stored);
+    stateFile.close();
+    Output::writeFully(STDOUT_FILENO, report(settings, fresh, old));
     return 0;
 }